@@ -221,42 +221,43 @@ Image3 hw_1_5(const std::vector<std::string> &params) {
 
     Image3 img(scene.resolution.x, scene.resolution.y);
 
-    int samples = 4;  // 4x4 sampling pattern
+    // the scene's anti-aliasing, unless overridden on the command line
+    AntiAliasing anti_aliasing = scene.anti_aliasing;
+    parse_anti_aliasing_flags(params, anti_aliasing);
+    const std::vector<Vector2> samples = sample_positions(anti_aliasing);
 
     for (int y = 0; y < img.height; y++) {
         for (int x = 0; x < img.width; x++) {
-            // anti-aliasing samples*sample pixels
-            for (int i = 0; i < samples; i++) {
-                for (int j = 0; j < samples; j++) {
-                    Vector2 pixel_point(x + Real(i + 0.5) / samples, y + Real(j + 0.5) / samples);
-                    Vector3 pixel_color = scene.background;
-
-                    for (const auto& shape : scene.shapes) {
-                        Matrix3x3 shapeTransform = get_transform(shape);
-                        Matrix3x3 inverseTransform = inverse(shapeTransform);
-
-                        //get Vector3 first than convert to Vector2
-                        Vector3 transformedPoint3 = inverseTransform * Vector3{pixel_point.x, pixel_point.y, 1.0};
-                        Vector2 transformedPoint = Vector2{transformedPoint3.x, transformedPoint3.y};
-
-                        if (auto *circle = std::get_if<Circle>(&shape)) {
-                            if (is_inside_circle(transformedPoint, *circle)) {
-                                pixel_color = circle->color;
-                            }
-                        } else if (auto *rectangle = std::get_if<Rectangle>(&shape)) {
-                            if (is_inside_rectangle(transformedPoint, *rectangle)) {
-                                pixel_color = rectangle->color;
-                            }
-                        } else if (auto *triangle = std::get_if<Triangle>(&shape)) {
-                            if (is_inside_triangle(transformedPoint, *triangle)) {
-                                pixel_color = triangle->color;
-                            }
+            // anti-aliasing: one sample in each cell of the pattern
+            for (const Vector2 &sample : samples) {
+                Vector2 pixel_point(x + sample.x, y + sample.y);
+                Vector3 pixel_color = scene.background;
+
+                for (const auto& shape : scene.shapes) {
+                    Matrix3x3 shapeTransform = get_transform(shape);
+                    Matrix3x3 inverseTransform = inverse(shapeTransform);
+
+                    //get Vector3 first than convert to Vector2
+                    Vector3 transformedPoint3 = inverseTransform * Vector3{pixel_point.x, pixel_point.y, 1.0};
+                    Vector2 transformedPoint = Vector2{transformedPoint3.x, transformedPoint3.y};
+
+                    if (auto *circle = std::get_if<Circle>(&shape)) {
+                        if (is_inside_circle(transformedPoint, *circle)) {
+                            pixel_color = circle->color;
+                        }
+                    } else if (auto *rectangle = std::get_if<Rectangle>(&shape)) {
+                        if (is_inside_rectangle(transformedPoint, *rectangle)) {
+                            pixel_color = rectangle->color;
+                        }
+                    } else if (auto *triangle = std::get_if<Triangle>(&shape)) {
+                        if (is_inside_triangle(transformedPoint, *triangle)) {
+                            pixel_color = triangle->color;
                         }
                     }
-                    img(x, y) += pixel_color;
                 }
+                img(x, y) += pixel_color;
             }
-            img(x, y) /= Real(samples * samples);
+            img(x, y) /= Real(samples.size());
         }
     }
 
@@ -274,7 +275,10 @@ Image3 hw_1_6(const std::vector<std::string> &params) {
     std::cout << scene << std::endl;
 
     Image3 img(scene.resolution.x, scene.resolution.y);
-    int samples = 4;  // 4x4 sampling pattern
+    // the scene's anti-aliasing, unless overridden on the command line
+    AntiAliasing anti_aliasing = scene.anti_aliasing;
+    parse_anti_aliasing_flags(params, anti_aliasing);
+    const std::vector<Vector2> samples = sample_positions(anti_aliasing);
 
     for (int y = 0; y < img.height; y++) {
         for (int x = 0; x < img.width; x++) {
@@ -282,48 +286,46 @@ Image3 hw_1_6(const std::vector<std::string> &params) {
             Real accumulated_alpha_main = 1.0;
 
             // Anti-aliasing: sample each pixel multiple times
-            for (int i = 0; i < samples; i++) {
-                for (int j = 0; j < samples; j++) {
-                    Vector2 pixel_point(x + Real(i + 0.5) / samples, y + Real(j + 0.5) / samples);
-                    Real accumulated_alpha_sample = 1.0;
-                    Vector3 sample_color = scene.background;
-
-                    for (const auto& shape : scene.shapes) {
-                        Matrix3x3 shapeTransform = get_transform(shape);
-                        Matrix3x3 inverseTransform = inverse(shapeTransform);
-                        Vector3 transformedPoint3 = inverseTransform * Vector3{pixel_point.x, pixel_point.y, 1.0};
-                        Vector2 transformedPoint = Vector2{transformedPoint3.x, transformedPoint3.y};
-
-                        Vector3 current_shape_color;
-                        Real current_shape_alpha = 0.0;
-
-                        if (auto *circle = std::get_if<Circle>(&shape)) {
-                            if (is_inside_circle(transformedPoint, *circle)) {
-                                current_shape_color = circle->color;
-                                current_shape_alpha = circle->alpha;
-                            }
-                        } else if (auto *rectangle = std::get_if<Rectangle>(&shape)) {
-                            if (is_inside_rectangle(transformedPoint, *rectangle)) {
-                                current_shape_color = rectangle->color;
-                                current_shape_alpha = rectangle->alpha;
-                            }
-                        } else if (auto *triangle = std::get_if<Triangle>(&shape)) {
-                            if (is_inside_triangle(transformedPoint, *triangle)) {
-                                current_shape_color = triangle->color;
-                                current_shape_alpha = triangle->alpha;
-                            }
+            for (const Vector2 &sample : samples) {
+                Vector2 pixel_point(x + sample.x, y + sample.y);
+                Real accumulated_alpha_sample = 1.0;
+                Vector3 sample_color = scene.background;
+
+                for (const auto& shape : scene.shapes) {
+                    Matrix3x3 shapeTransform = get_transform(shape);
+                    Matrix3x3 inverseTransform = inverse(shapeTransform);
+                    Vector3 transformedPoint3 = inverseTransform * Vector3{pixel_point.x, pixel_point.y, 1.0};
+                    Vector2 transformedPoint = Vector2{transformedPoint3.x, transformedPoint3.y};
+
+                    Vector3 current_shape_color;
+                    Real current_shape_alpha = 0.0;
+
+                    if (auto *circle = std::get_if<Circle>(&shape)) {
+                        if (is_inside_circle(transformedPoint, *circle)) {
+                            current_shape_color = circle->color;
+                            current_shape_alpha = circle->alpha;
+                        }
+                    } else if (auto *rectangle = std::get_if<Rectangle>(&shape)) {
+                        if (is_inside_rectangle(transformedPoint, *rectangle)) {
+                            current_shape_color = rectangle->color;
+                            current_shape_alpha = rectangle->alpha;
+                        }
+                    } else if (auto *triangle = std::get_if<Triangle>(&shape)) {
+                        if (is_inside_triangle(transformedPoint, *triangle)) {
+                            current_shape_color = triangle->color;
+                            current_shape_alpha = triangle->alpha;
                         }
-
-                        // Alpha blending for this sample
-                        sample_color = current_shape_alpha * current_shape_color + (1 - current_shape_alpha) * sample_color;
-                        accumulated_alpha_sample *= (1 - current_shape_alpha);
                     }
 
-                    accumulated_color += sample_color;
+                    // Alpha blending for this sample
+                    sample_color = current_shape_alpha * current_shape_color + (1 - current_shape_alpha) * sample_color;
+                    accumulated_alpha_sample *= (1 - current_shape_alpha);
                 }
+
+                accumulated_color += sample_color;
             }
 
-            accumulated_color /= Real(samples * samples); // Average the color for anti-aliasing
+            accumulated_color /= Real(samples.size()); // Average the color for anti-aliasing
             img(x, y) = accumulated_color;
         }
     }
@@ -147,6 +147,12 @@ Scene parse_scene(const fs::path &filename) {
             (*background)[0], (*background)[1], (*background)[2]
         };
     }
+    if (auto aa_factor = data.find("aa_factor"); aa_factor != data.end()) {
+        scene.anti_aliasing.aa_factor = *aa_factor;
+    }
+    if (auto pattern = data.find("sample_pattern"); pattern != data.end()) {
+        scene.anti_aliasing.pattern = parse_sample_pattern(*pattern);
+    }
 
     auto objects = data.find("objects");
     for (auto it = objects->begin(); it != objects->end(); it++) {
@@ -3,6 +3,7 @@
 #include "balboa.h"
 #include "vector.h"
 #include "matrix.h"
+#include "sample_pattern.h"
 #include <variant>
 #include <vector>
 
@@ -57,6 +58,7 @@ struct Scene {
     Vector2i resolution;
     Vector3 background;
     std::vector<Shape> shapes;
+    AntiAliasing anti_aliasing;
 };
 
 Scene parse_scene(const fs::path &filename);
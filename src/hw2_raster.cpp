@@ -0,0 +1,2724 @@
+#include "hw2_raster.h"
+#include "hw2_raster_kernel.h"
+#include "hw2_raster_simd.h"
+#include "parallel.h"
+#include "flexception.h"
+#include <algorithm>
+#include <mutex>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace hw2 {
+
+/**
+ * Check if a point is inside a triangle
+ * @param p0 The first vertex of the triangle
+ * @param p1 The second vertex of the triangle
+ * @param p2 The third vertex of the triangle
+ * @param p The point to be checked
+ * @return True if the point is inside the triangle, false otherwise
+ */
+bool is_inside_triangle(Vector2 p0, Vector2 p1, Vector2 p2, Vector2 p) {
+    // Compute the edge vectors of the triangle
+    Vector2 e01 = p1 - p0;
+    Vector2 e12 = p2 - p1;
+    Vector2 e20 = p0 - p2;
+
+    // Rotate each edge vector by 90 degrees to obtain the normal vectors
+    Vector2 n01(e01.y, -e01.x);
+    Vector2 n12(e12.y, -e12.x);
+    Vector2 n20(e20.y, -e20.x);
+
+    // Compute dot products
+    float d1 = dot(p - p0, n01);
+    float d2 = dot(p - p1, n12);
+    float d3 = dot(p - p2, n20);
+
+    // Check if the point lies in the intersection of all positive or all negative half-planes
+    return (d1 >= 0 && d2 >= 0 && d3 >= 0) || (d1 <= 0 && d2 <= 0 && d3 <= 0);
+}
+
+/**
+ * Project a 3D point to 2D
+ * @param p The 3D point to be projected
+ * @return The projected 2D point
+ */
+Vector2 project(const Vector3 &p) {
+    return { -p.x / p.z, -p.y / p.z };
+}
+
+/**
+ * Convert a projected point to screen space
+ * @param p The projected point
+ * @param width The width of the screen
+ * @param height The height of the screen
+ * @param s The scaling factor of the view frustum
+ * @return The point in screen space
+ */
+Vector2 toScreenSpace(const Vector2 &p, int width, int height, Real s) {
+    float aspect_ratio = static_cast<float>(width) / height;
+
+    return { width * (p.x + aspect_ratio * s) / (2 * aspect_ratio * s),
+             height * (1 - (p.y + s) / (2 * s)) };  // y-axis is flipped
+}
+
+/**
+ * Compute the barycentric coordinates of a point in a triangle
+ * @param A The first vertex of the triangle
+ * @param B The second vertex of the triangle
+ * @param C The third vertex of the triangle
+ * @param P The point to be checked
+ * @return The barycentric coordinates of the point
+ */
+Vector3 barycentric_coordinates(const Vector2 &A, const Vector2 &B, const Vector2 &C, const Vector2 &P) {
+    Real denom = (B.y - C.y) * (A.x - C.x) + (C.x - B.x) * (A.y - C.y);
+    if (std::abs(denom) < 1e-6) {
+        // Triangle is degenerate, return invalid barycentric coordinates
+        return Vector3{-1, -1, -1};
+    }
+
+    Real b0 = ((B.y - C.y) * (P.x - C.x) + (C.x - B.x) * (P.y - C.y)) / denom;
+    Real b1 = ((C.y - A.y) * (P.x - C.x) + (A.x - C.x) * (P.y - C.y)) / denom;
+    Real b2 = 1.0 - b0 - b1;
+
+    return Vector3{b0, b1, b2};
+}
+
+/**
+ * Transform a point by a matrix from Matrix4x4 to Vector3
+ * @param m The transformation matrix
+ * @param p The point to be transformed
+ * @return The transformed point
+ */
+Vector3 transform_point(const Matrix4x4 &m, const Vector3 &p) {
+    Vector4 p_homogeneous(p.x, p.y, p.z, 1.0);
+    Vector4 p_transformed = m * p_homogeneous;
+    return Vector3(p_transformed.x / p_transformed.w,
+                   p_transformed.y / p_transformed.w,
+                   p_transformed.z / p_transformed.w);
+}
+
+/**
+ * Rasterize a triangle one sample at a time, specialized for a set of KernelFeatures
+ * @param tri The triangle
+ * @param x_min The first column to rasterize
+ * @param x_max The last column to rasterize
+ * @param y_min The first row to rasterize
+ * @param y_max The last row to rasterize
+ * @param target The super-sampled color and depth buffers
+ * @return The number of samples shaded, or given an id in visibility-buffer mode
+ */
+template <typename T, int Features>
+int64_t rasterize_triangle_scalar(const ScreenTriangle<T> &tri, int x_min, int x_max, int y_min, int y_max,
+                                  const RasterTarget<T> &target) {
+    constexpr bool flat = Features & KERNEL_FLAT;
+    constexpr bool visibility = Features & KERNEL_VISIBILITY;
+    constexpr bool has_pattern = Features & KERNEL_PATTERN;
+    constexpr bool covered = Features & KERNEL_COVERED;
+    constexpr bool depth_test = Features & KERNEL_DEPTH_TEST;
+    // Edge functions at the first sample center of the row,
+    // stepped by additions only from there on.
+    const int64_t half = SUBPIXEL_ONE / 2;
+    int64_t step_x[3], w_row[3];
+    for (int i = 0; i < 3; i++) {
+        step_x[i] = tri.A[i] * SUBPIXEL_ONE;
+        w_row[i] = tri.A[i] * (x_min * SUBPIXEL_ONE + half) +
+                   tri.B[i] * (y_min * SUBPIXEL_ONE + half) + tri.C[i];
+    }
+    // Per pattern column of the current row: how far its samples move the
+    // edges, and the planes from the cell centers
+    const SampleOffsets *pattern = target.pattern;
+    int64_t edge_shift[3][MAX_PATTERN_SIZE] = {};
+    T inv_w_shift[MAX_PATTERN_SIZE];
+    T attribute_shift[NUM_COLOR_ATTRIBUTES][MAX_PATTERN_SIZE];
+    int64_t shaded = 0;
+    for (int y = y_min; y <= y_max; y++) {
+        int64_t w0 = w_row[0], w1 = w_row[1], w2 = w_row[2];
+        TVector3<T> *color_row = target.color + int64_t(y - target.y0) * target.color_width;
+        if constexpr (has_pattern) {
+            for (int cx = 0; cx < pattern->size; cx++) {
+                int cell = (y % pattern->size) * pattern->size + cx;
+                T fx = T(pattern->fx[cell]), fy = T(pattern->fy[cell]);
+                for (int i = 0; i < 3; i++) {
+                    edge_shift[i][cx] = tri.A[i] * pattern->dx[cell] + tri.B[i] * pattern->dy[cell];
+                }
+                inv_w_shift[cx] = tri.inv_w.shift(fx, fy);
+                for (int k = 0; k < NUM_COLOR_ATTRIBUTES && !flat; k++) {
+                    attribute_shift[k][cx] = tri.attributes[k].shift(fx, fy);
+                }
+            }
+        }
+        T inv_w_row = tri.inv_w.row(y - tri.y_min);
+        T attribute_row[NUM_COLOR_ATTRIBUTES];
+        if (!flat) {
+            for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+                attribute_row[k] = tri.attributes[k].row(y - tri.y_min);
+            }
+        }
+        for (int x = x_min; x <= x_max; x++) {
+            const int cx = has_pattern ? x & (pattern->size - 1) : 0;
+            if (covered || ((w0 + edge_shift[0][cx]) | (w1 + edge_shift[1][cx]) | (w2 + edge_shift[2][cx])) >= 0) {
+                T column = T(x - tri.x_min);
+                T depth = inv_w_row + tri.inv_w.dx * column;
+                if constexpr (has_pattern) {
+                    depth = depth + inv_w_shift[cx];
+                }
+
+                // The depth test runs at the precision of the buffer
+                const float stored = float(depth);
+                int64_t index = int64_t(y - target.y0) * target.width + (x - target.x0);
+                if (!depth_test || stored > target.depth[index]) {
+                    if (visibility) {
+                        target.ids[index] = tri.id;
+                    } else if (flat) {
+                        color_row[x - target.x0] = tri.color;
+                    } else {
+                        T w = T(1) / depth;
+                        TVector3<T> &c = color_row[x - target.x0];
+                        for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+                            T value = attribute_row[k] + tri.attributes[k].dx * column;
+                            if constexpr (has_pattern) {
+                                value = value + attribute_shift[k][cx];
+                            }
+                            c[k] = value * w;
+                        }
+                    }
+                    target.depth[index] = stored;
+                    shaded++;
+                }
+            }
+            w0 += step_x[0];
+            w1 += step_x[1];
+            w2 += step_x[2];
+        }
+        for (int i = 0; i < 3; i++) {
+            w_row[i] += tri.B[i] * SUBPIXEL_ONE;
+        }
+    }
+    return shaded;
+}
+
+/**
+ * The scalar kernels of every combination of features
+ */
+template <typename T, int... Features>
+static RasterKernelTable<T> scalar_kernel_table(std::integer_sequence<int, Features...>) {
+    return {&rasterize_triangle_scalar<T, Features>...};
+}
+
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_scalar_kernels() {
+    static const RasterKernelTable<T> table =
+        scalar_kernel_table<T>(std::make_integer_sequence<int, NUM_KERNEL_VARIANTS>());
+    return table;
+}
+
+/**
+ * The SIMD kernels of the baseline instruction set (SSE2 on x86) of every combination of features
+ */
+template <typename T, int... Features>
+static RasterKernelTable<T> sse_kernel_table(std::integer_sequence<int, Features...>) {
+    return {&SIMD_NAMESPACE::rasterize_triangle<T, Features>...};
+}
+
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_sse_kernels() {
+    static const RasterKernelTable<T> table = sse_kernel_table<T>(std::make_integer_sequence<int, NUM_KERNEL_VARIANTS>());
+    return table;
+}
+
+/**
+ * Weigh rows of samples into one, a value at a time
+ * @param out The weighted sum of the rows
+ * @param rows The rows
+ * @param weights The weight of every row
+ * @param taps The number of rows
+ * @param count The number of values per row
+ */
+template <typename T>
+void filter_rows_scalar(T *out, const T *const *rows, const T *weights, int taps, int count) {
+    for (int i = 0; i < count; i++) {
+        T sum = weights[0] * rows[0][i];
+        for (int k = 1; k < taps; k++) {
+            sum = sum + weights[k] * rows[k][i];
+        }
+        out[i] = sum;
+    }
+}
+
+/**
+ * Weigh rows of samples into one with the SIMD kernel of the baseline instruction set
+ */
+template <typename T>
+void filter_rows_sse(T *out, const T *const *rows, const T *weights, int taps, int count) {
+    SIMD_NAMESPACE::filter_rows(out, rows, weights, taps, count);
+}
+
+/**
+ * Light fragments one at a time with the exact normalize and pow, as hw_3_4.fs does
+ * @param fragments The fragments
+ * @param count The number of fragments
+ * @param lights The lights in camera space
+ * @param num_lights The number of lights
+ */
+void shade_lights_scalar(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights) {
+    for (int i = 0; i < count; i++) {
+        Vector3f n = normalize(Vector3f{fragments.normal[0][i], fragments.normal[1][i], fragments.normal[2][i]});
+        Vector3f v = normalize(Vector3f{-fragments.view[0][i], -fragments.view[1][i], 1.f});
+        Vector3f light{0, 0, 0};
+        for (int l = 0; l < num_lights; l++) {
+            Vector3f dir{lights[l].direction[0], lights[l].direction[1], lights[l].direction[2]};
+            float n_dot_l = dot(n, dir);
+            Vector3f r = 2.f * n_dot_l * n - dir;
+            float spec = std::pow(max(dot(v, r), 0.f), fragments.shininess[i]);
+            float strength;
+            if (fragments.shadow) {
+                strength = AMBIENT_STRENGTH + fragments.shadow[l * fragments.shadow_stride + i] *
+                                                  (max(n_dot_l, 0.f) + SPECULAR_STRENGTH * spec);
+            } else {
+                strength = AMBIENT_STRENGTH + max(n_dot_l, 0.f) + SPECULAR_STRENGTH * spec;
+            }
+            light += strength * Vector3f{lights[l].color[0], lights[l].color[1], lights[l].color[2]};
+        }
+        for (int c = 0; c < 3; c++) {
+            fragments.color[c][i] = light[c] * fragments.albedo[c][i];
+        }
+    }
+}
+
+/**
+ * Light fragments with the SIMD kernel of the baseline instruction set
+ */
+void shade_lights_sse(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights) {
+    SIMD_NAMESPACE::shade_lights(fragments, count, lights, num_lights);
+}
+
+/**
+ * Rasterize the depth of a triangle into a tiled depth map one sample at a time
+ * @param tri The triangle
+ * @param x_min The first column to rasterize
+ * @param x_max The last column to rasterize
+ * @param y_min The first row to rasterize
+ * @param y_max The last row to rasterize
+ * @param map The depth map
+ * @return The number of samples written
+ */
+int64_t rasterize_depth_scalar(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                               const DepthMap &map) {
+    const int64_t half = SUBPIXEL_ONE / 2;
+    int64_t step_x[3], w_row[3];
+    for (int i = 0; i < 3; i++) {
+        step_x[i] = tri.A[i] * SUBPIXEL_ONE;
+        w_row[i] = tri.A[i] * (x_min * SUBPIXEL_ONE + half) +
+                   tri.B[i] * (y_min * SUBPIXEL_ONE + half) + tri.C[i];
+    }
+    int64_t written = 0;
+    for (int y = y_min; y <= y_max; y++) {
+        int64_t w0 = w_row[0], w1 = w_row[1], w2 = w_row[2];
+        const float depth_row = tri.inv_w.row(y - tri.y_min);
+        for (int x = x_min; x <= x_max; x++) {
+            if ((w0 | w1 | w2) >= 0) {
+                const float depth = depth_row + tri.inv_w.dx * float(x - tri.x_min);
+                float &stored = map.depth[map.index(x, y)];
+                if (depth > stored) {
+                    stored = depth;
+                    written++;
+                }
+            }
+            w0 += step_x[0];
+            w1 += step_x[1];
+            w2 += step_x[2];
+        }
+        for (int i = 0; i < 3; i++) {
+            w_row[i] += tri.B[i] * SUBPIXEL_ONE;
+        }
+    }
+    return written;
+}
+
+/**
+ * Rasterize the depth of a triangle with the SIMD kernel of the baseline instruction set
+ */
+int64_t rasterize_depth_sse(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                            const DepthMap &map) {
+    return SIMD_NAMESPACE::rasterize_depth(tri, x_min, x_max, y_min, y_max, map);
+}
+
+/**
+ * Count the set bits of a sample mask
+ * @param mask The mask
+ * @return The number of samples in the mask
+ */
+static int count_samples(uint64_t mask) {
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Give some samples of a multisampled pixel a new color.
+ * The samples are taken out of the slots they were in and, if a slot is free,
+ * put into one of their own. Otherwise they are merged into the slot of the
+ * closest color, which keeps the average of the pixel exact until that slot
+ * is partly overwritten again.
+ * @param pixel The pixel
+ * @param mask The samples to recolor
+ * @param color The new color
+ */
+template <typename T>
+static void write_msaa_samples(MsaaPixel<T> &pixel, uint64_t mask, const TVector3<T> &color) {
+    int free_slot = -1;
+    for (int s = 0; s < MSAA_SLOTS; s++) {
+        pixel.mask[s] &= ~mask;
+        if (pixel.mask[s] == 0 && free_slot < 0) {
+            free_slot = s;
+        }
+    }
+    if (free_slot >= 0) {
+        pixel.color[free_slot] = color;
+        pixel.mask[free_slot] = mask;
+        return;
+    }
+    int closest = 0;
+    for (int s = 1; s < MSAA_SLOTS; s++) {
+        if (length_squared(pixel.color[s] - color) < length_squared(pixel.color[closest] - color)) {
+            closest = s;
+        }
+    }
+    T old_count = T(count_samples(pixel.mask[closest]));
+    T new_count = T(count_samples(mask));
+    pixel.color[closest] = (old_count * pixel.color[closest] + new_count * color) / (old_count + new_count);
+    pixel.mask[closest] |= mask;
+}
+
+/**
+ * Rasterize a triangle into the multisample buffers. Coverage and depth are
+ * resolved per sample, but the color is computed once per pixel, at the
+ * centroid of the samples the triangle won there.
+ * FixedAA is the samples per pixel axis when known at compile time, so the
+ * sample cells and masks of a pixel cost shifts, or 0 to read it from the target.
+ * @param tri The triangle
+ * @param x_min The first column of samples to rasterize
+ * @param x_max The last column of samples to rasterize
+ * @param y_min The first row of samples to rasterize
+ * @param y_max The last row of samples to rasterize
+ * @param target The per-sample depth buffer and the multisample color buffer
+ * @return The number of pixels shaded
+ */
+template <typename T, int FixedAA, int Features>
+int64_t rasterize_triangle_msaa(const ScreenTriangle<T> &tri, int x_min, int x_max, int y_min, int y_max,
+                                const RasterTarget<T> &target) {
+    constexpr bool flat = Features & KERNEL_FLAT;
+    constexpr bool has_pattern = Features & KERNEL_PATTERN;
+    constexpr bool covered = Features & KERNEL_COVERED;
+    constexpr bool depth_test = Features & KERNEL_DEPTH_TEST;
+    const int AA = FixedAA > 0 ? FixedAA : target.aa_factor;
+    const int64_t half = SUBPIXEL_ONE / 2;
+    int64_t shaded = 0;
+    for (int py = y_min / AA; py <= y_max / AA; py++) {
+        int sy0 = max(py * AA, y_min), sy1 = min(py * AA + AA - 1, y_max);
+        for (int px = x_min / AA; px <= x_max / AA; px++) {
+            int sx0 = max(px * AA, x_min), sx1 = min(px * AA + AA - 1, x_max);
+
+            uint64_t won = 0;
+            int column_sum = 0, row_sum = 0;
+            T shift_x_sum = 0, shift_y_sum = 0; // of the samples off their cell centers
+            for (int y = sy0; y <= sy1; y++) {
+                // The cell of a sample within its pixel, which is also its bit in the masks
+                const int row_cell = (y - py * AA) * AA - px * AA;
+                for (int x = sx0; x <= sx1; x++) {
+                    const int cell = row_cell + x;
+                    int64_t X = x * SUBPIXEL_ONE + half, Y = y * SUBPIXEL_ONE + half;
+                    if constexpr (has_pattern) {
+                        X += target.pattern->dx[cell];
+                        Y += target.pattern->dy[cell];
+                    }
+                    int64_t w0 = tri.A[0] * X + tri.B[0] * Y + tri.C[0];
+                    int64_t w1 = tri.A[1] * X + tri.B[1] * Y + tri.C[1];
+                    int64_t w2 = tri.A[2] * X + tri.B[2] * Y + tri.C[2];
+                    if (!covered && (w0 | w1 | w2) < 0) {
+                        continue;
+                    }
+                    T depth = tri.inv_w.row(y - tri.y_min) + tri.inv_w.dx * T(x - tri.x_min);
+                    if constexpr (has_pattern) {
+                        depth = depth + tri.inv_w.shift(T(target.pattern->fx[cell]), T(target.pattern->fy[cell]));
+                    }
+
+                    const float stored = float(depth);
+                    int64_t index = int64_t(y - target.y0) * target.width + (x - target.x0);
+                    if (!depth_test || stored > target.depth[index]) {
+                        target.depth[index] = stored;
+                        won |= uint64_t(1) << cell;
+                        column_sum += x - tri.x_min;
+                        row_sum += y - tri.y_min;
+                        if constexpr (has_pattern) {
+                            shift_x_sum += T(target.pattern->fx[cell]);
+                            shift_y_sum += T(target.pattern->fy[cell]);
+                        }
+                    }
+                }
+            }
+            if (won == 0) {
+                continue;
+            }
+
+            TVector3<T> color = tri.color;
+            if (!flat) {
+                // Interpolate at the centroid of the won samples
+                T n = T(count_samples(won));
+                T column = (T(column_sum) + shift_x_sum) / n, row = (T(row_sum) + shift_y_sum) / n;
+                T w = T(1) / (tri.inv_w.c + tri.inv_w.dx * column + tri.inv_w.dy * row);
+                for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+                    const AttributePlane<T> &plane = tri.attributes[k];
+                    color[k] = (plane.c + plane.dx * column + plane.dy * row) * w;
+                }
+            }
+            int64_t pixel = int64_t(py - target.y0 / AA) * target.pixel_width + (px - target.x0 / AA);
+            write_msaa_samples(target.pixels[pixel], won, color);
+            shaded++;
+        }
+    }
+    return shaded;
+}
+
+/**
+ * The multisample kernels of every combination of features
+ */
+template <typename T, int FixedAA, int... Features>
+static RasterKernelTable<T> msaa_kernel_table(std::integer_sequence<int, Features...>) {
+    return {&rasterize_triangle_msaa<T, FixedAA, Features>...};
+}
+
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_msaa_kernels(int aa_factor) {
+    using Variants = std::make_integer_sequence<int, NUM_KERNEL_VARIANTS>;
+    static const RasterKernelTable<T> tables[] = {
+        msaa_kernel_table<T, 0>(Variants()), msaa_kernel_table<T, 1>(Variants()),
+        msaa_kernel_table<T, 2>(Variants()), msaa_kernel_table<T, 4>(Variants()),
+        msaa_kernel_table<T, 8>(Variants())
+    };
+    switch (aa_factor) {
+        case 1: return tables[1];
+        case 2: return tables[2];
+        case 4: return tables[3];
+        case 8: return tables[4];
+        default: return tables[0];
+    }
+}
+
+template const RasterKernelTable<float> &rasterize_triangle_scalar_kernels<float>();
+template const RasterKernelTable<double> &rasterize_triangle_scalar_kernels<double>();
+template const RasterKernelTable<float> &rasterize_triangle_sse_kernels<float>();
+template const RasterKernelTable<double> &rasterize_triangle_sse_kernels<double>();
+template const RasterKernelTable<float> &rasterize_triangle_msaa_kernels<float>(int);
+template const RasterKernelTable<double> &rasterize_triangle_msaa_kernels<double>(int);
+template void filter_rows_scalar<float>(float *, const float *const *, const float *, int, int);
+template void filter_rows_scalar<double>(double *, const double *const *, const double *, int, int);
+template void filter_rows_sse<float>(float *, const float *const *, const float *, int, int);
+template void filter_rows_sse<double>(double *, const double *const *, const double *, int, int);
+
+RenderOptions parse_render_options(const std::vector<std::string> &params) {
+    RenderOptions options;
+    for (int i = 0; i < (int)params.size(); i++) {
+        if (params[i] == "-aa") {
+            options.aa_factor = max(std::stoi(params[++i]), 1);
+        } else if (params[i] == "-sample_pattern") {
+            options.sample_pattern = parse_sample_pattern(params[++i]);
+        } else if (params[i] == "-threads") {
+            options.num_threads = std::stoi(params[++i]);
+        } else if (params[i] == "-tile_size") {
+            options.tile_size = max(std::stoi(params[++i]), 1);
+        } else if (params[i] == "-block_size") {
+            options.block_size = max(std::stoi(params[++i]), 0);
+        } else if (params[i] == "-msaa") {
+            options.msaa = true;
+        } else if (params[i] == "-adaptive_aa") {
+            options.adaptive_aa = true;
+        } else if (params[i] == "-adaptive_tolerance") {
+            options.adaptive_tolerance = std::stod(params[++i]);
+        } else if (params[i] == "-sort") {
+            options.sort_front_to_back = true;
+        } else if (params[i] == "-visibility_buffer") {
+            options.visibility_buffer = true;
+        } else if (params[i] == "-occlusion_culling") {
+            options.occlusion_culling = true;
+        } else if (params[i] == "-stats") {
+            options.print_stats = true;
+        } else if (params[i] == "-simd") {
+            std::string mode = to_lowercase(params[++i]);
+            if (mode == "scalar") {
+                options.simd = SimdMode::Scalar;
+            } else if (mode == "sse") {
+                options.simd = SimdMode::SSE;
+            } else if (mode == "avx2") {
+                options.simd = SimdMode::AVX2;
+            } else {
+                Error("Unknown -simd mode " + mode + " (expected scalar, sse or avx2).");
+            }
+        } else if (params[i] == "-precision") {
+            std::string precision = to_lowercase(params[++i]);
+            if (precision == "double") {
+                options.precision = Precision::Double;
+            } else if (precision == "float") {
+                options.precision = Precision::Float;
+            } else {
+                Error("Unknown -precision " + precision + " (expected float or double).");
+            }
+        } else if (params[i] == "-compare_precision") {
+            options.compare_precision = true;
+        } else if (params[i] == "-filter") {
+            std::string filter = to_lowercase(params[++i]);
+            if (filter == "box") {
+                options.filter = ResolveFilter::Box;
+            } else if (filter == "tent") {
+                options.filter = ResolveFilter::Tent;
+            } else if (filter == "mitchell") {
+                options.filter = ResolveFilter::Mitchell;
+            } else if (filter == "lanczos") {
+                options.filter = ResolveFilter::Lanczos;
+            } else {
+                Error("Unknown -filter " + filter + " (expected box, tent, mitchell or lanczos).");
+            }
+        } else if (params[i] == "-shadow_map") {
+            options.shadow_map_size = max(std::stoi(params[++i]), 0);
+        } else if (params[i] == "-shadow_pcf") {
+            options.shadow_pcf = max(std::stoi(params[++i]), 1);
+        } else if (params[i] == "-texture_filter") {
+            std::string filter = to_lowercase(params[++i]);
+            if (filter == "bilinear") {
+                options.texture_filter = TextureFilter::Bilinear;
+            } else if (filter == "trilinear") {
+                options.texture_filter = TextureFilter::Trilinear;
+            } else {
+                Error("Unknown -texture_filter " + filter + " (expected bilinear or trilinear).");
+            }
+        }
+    }
+    return options;
+}
+
+namespace {
+
+/// Snapped vertices must stay within this many super-samples of the origin
+/// so that the 64-bit edge functions cannot overflow.
+constexpr Real MAX_SCREEN_COORD = Real(1 << 21);
+
+inline int64_t floor_div(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/// What the culling stage decided about a triangle.
+enum class CullResult : uint8_t {
+    Visible,
+    Frustum, // outside the view frustum, with its mesh or on its own
+    BackFace, // seen from behind on a mesh with cull_backface
+    NoCoverage, // covers no sample
+    Degenerate, // zero area, or too far out to be snapped to fixed point
+    Empty // a spare slot of a clipped triangle
+};
+
+/// Outcode bits: the planes of a Frustum a point lies outside of.
+constexpr int CLIP_NEAR = 1 << 0;
+constexpr int CLIP_FAR = 1 << 1;
+constexpr int CLIP_SIDES = 0xf << 2; // left, right, bottom, top
+constexpr int CLIP_GUARD = 0xf << 6; // the sides of the guard band
+constexpr int NUM_CLIP_PLANES = 10;
+
+/// The view frustum in camera space, looking down -z, as planes
+/// (a, b, c, d) with a * x + b * y + c * z + d >= 0 on the inside:
+/// near, far, left, right, bottom, top, and the same four sides widened
+/// into a guard band. Triangles only need clipping against the near and
+/// far planes and the guard band. Inside the guard band the screen
+/// positions stay small enough to snap to fixed point, and the rasterizer
+/// discards the samples off the screen on its own.
+struct Frustum {
+    Vector4 planes[NUM_CLIP_PLANES];
+
+    /**
+     * @param aspect_ratio The width of the screen over its height
+     * @param s The scaling factor of the view frustum
+     * @param z_near The distance of the near clipping plane
+     * @param z_far The distance of the far clipping plane, may be infinite
+     * @param guard_band How many times wider than the screen the guard band is
+     */
+    Frustum(Real aspect_ratio, Real s, Real z_near, Real z_far, Real guard_band) {
+        planes[0] = Vector4{Real(0), Real(0), Real(-1), -z_near};
+        planes[1] = std::isinf(z_far) ? Vector4{Real(0), Real(0), Real(0), Real(1)} :
+                                          Vector4{Real(0), Real(0), Real(1), z_far};
+        for (int g = 0; g < 2; g++) {
+            Real sx = aspect_ratio * s * (g ? guard_band : 1);
+            Real sy = s * (g ? guard_band : 1);
+            planes[2 + 4 * g] = Vector4{Real(1), Real(0), -sx, Real(0)};
+            planes[3 + 4 * g] = Vector4{Real(-1), Real(0), -sx, Real(0)};
+            planes[4 + 4 * g] = Vector4{Real(0), Real(1), -sy, Real(0)};
+            planes[5 + 4 * g] = Vector4{Real(0), Real(-1), -sy, Real(0)};
+        }
+    }
+
+    Real distance(int plane, const Vector3 &p) const {
+        const Vector4 &e = planes[plane];
+        return e.x * p.x + e.y * p.y + e.z * p.z + e.w;
+    }
+
+    /// The planes a point lies outside of, as CLIP_* bits.
+    int outcode(const Vector3 &p) const {
+        int code = 0;
+        for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+            if (distance(plane, p) < 0) {
+                code |= 1 << plane;
+            }
+        }
+        return code;
+    }
+
+    /// True if a sphere lies entirely outside one of the frustum planes.
+    bool outside(const Vector3 &center, Real radius) const {
+        for (int plane = 0; plane < 6; plane++) {
+            const Vector4 &e = planes[plane];
+            if (distance(plane, center) < -radius * length(Vector3{e.x, e.y, e.z})) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/// A vertex of a polygon being clipped, in camera space, with its attributes.
+struct ClipVertex {
+    Vector3 position;
+    Vector3 color;
+    Vector3 normal; // in camera space, when the frame is lit
+};
+
+/// Every plane cuts at most one corner off a convex polygon,
+/// adding at most one vertex to the triangle.
+constexpr int MAX_CLIP_VERTICES = 3 + 6;
+
+/**
+ * Clip a convex polygon against some of the planes of a frustum (Sutherland-Hodgman)
+ * @param poly The polygon, replaced by the clipped one
+ * @param count The number of vertices of the polygon
+ * @param frustum The frustum
+ * @param planes The CLIP_* bits of the planes to clip against
+ * @return The number of vertices of the clipped polygon, less than 3 if nothing is left
+ */
+int clip_polygon(ClipVertex poly[MAX_CLIP_VERTICES], int count, const Frustum &frustum, int planes) {
+    ClipVertex clipped[MAX_CLIP_VERTICES];
+    for (int plane = 0; plane < NUM_CLIP_PLANES && count >= 3; plane++) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+        int clipped_count = 0;
+        for (int i = 0; i < count; i++) {
+            const ClipVertex &a = poly[i];
+            const ClipVertex &b = poly[(i + 1) % count];
+            Real da = frustum.distance(plane, a.position);
+            Real db = frustum.distance(plane, b.position);
+            if (da >= 0) {
+                clipped[clipped_count++] = a;
+            }
+            if ((da >= 0) != (db >= 0)) {
+                // Attributes are linear over the triangle in camera space
+                Real t = da / (da - db);
+                clipped[clipped_count++] = ClipVertex{a.position + t * (b.position - a.position),
+                                                      a.color + t * (b.color - a.color),
+                                                      a.normal + t * (b.normal - a.normal)};
+            }
+        }
+        std::copy(clipped, clipped + clipped_count, poly);
+        count = clipped_count;
+    }
+    return count;
+}
+
+/**
+ * Set up the plane of a quantity that is linear on the screen over a triangle
+ * @param tri The triangle, with its edges and bounding box set up
+ * @param w The unbiased edge functions at the center of sample (tri.x_min, tri.y_min)
+ * @param inv_area One over twice the area of the triangle in fixed point
+ * @param values The quantity at the three vertices
+ * @return The plane
+ */
+template <typename T>
+AttributePlane<T> setup_plane(const ScreenTriangle<T> &tri, const int64_t w[3], Real inv_area, const Real values[3]) {
+    // The barycentric coordinate of vertex i is its edge function over twice the area
+    Real dx = 0, dy = 0, c = 0;
+    for (int i = 0; i < 3; i++) {
+        dx += Real(tri.A[i] * SUBPIXEL_ONE) * values[i];
+        dy += Real(tri.B[i] * SUBPIXEL_ONE) * values[i];
+        c += Real(w[i]) * values[i];
+    }
+    return AttributePlane<T>{T(dx * inv_area), T(dy * inv_area), T(c * inv_area)};
+}
+
+/**
+ * Snap a screen space triangle to fixed point and set up its edge functions
+ * and the planes of 1/w and of its vertex colors and normals over w
+ * @param tri The triangle to set up
+ * @param attribute_planes Room for the NUM_COLOR_ATTRIBUTES color planes
+ * @param normal_planes Room for the 3 normal planes
+ * @param p The vertices in super-sampled screen space
+ * @param inv_w One over the distance of the vertices along the view direction
+ * @param colors The vertex colors, or null for a flat triangle
+ * @param normals The vertex normals in camera space, or null for an unlit triangle
+ * @param width The width of the super-sampled screen
+ * @param height The height of the super-sampled screen
+ * @param cull_backface Reject the triangle if it is seen from behind
+ * @param pattern The sample offsets, or null for the grid pattern
+ * @return Visible, or why the triangle need not be rasterized
+ */
+template <typename T>
+CullResult setup_triangle(ScreenTriangle<T> &tri, AttributePlane<T> *attribute_planes,
+                          AttributePlane<T> *normal_planes, const Vector2 p[3], const Real inv_w[3],
+                          const Vector3 *colors, const Vector3 *normals, int width, int height, bool cull_backface,
+                          const SampleOffsets *pattern) {
+    int64_t X[3], Y[3];
+    for (int i = 0; i < 3; i++) {
+        // the negated comparison also rejects NaNs
+        if (!(std::abs(p[i].x) < MAX_SCREEN_COORD && std::abs(p[i].y) < MAX_SCREEN_COORD)) {
+            return CullResult::Degenerate;
+        }
+        X[i] = std::llround(p[i].x * SUBPIXEL_ONE);
+        Y[i] = std::llround(p[i].y * SUBPIXEL_ONE);
+    }
+
+    // Twice the signed area. Both windings are drawn, so flip the clockwise ones.
+    int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+    if (area == 0) {
+        return CullResult::Degenerate;
+    }
+    // Front faces are counter-clockwise seen from the camera,
+    // which is a negative area with the y-axis of the screen pointing down.
+    if (cull_backface && area > 0) {
+        return CullResult::BackFace;
+    }
+    int64_t sign = area > 0 ? 1 : -1;
+    int64_t unbiased_C[3];
+    for (int i = 0; i < 3; i++) {
+        int a = (i + 1) % 3, b = (i + 2) % 3;
+        tri.A[i] = sign * (Y[a] - Y[b]);
+        tri.B[i] = sign * (X[b] - X[a]);
+        tri.C[i] = sign * (X[a] * Y[b] - Y[a] * X[b]);
+        unbiased_C[i] = tri.C[i];
+        // Top-left rule: the interior lies right of a left edge (A > 0)
+        // or below a horizontal top edge (A == 0, B > 0).
+        // Other edges exclude the samples lying exactly on them.
+        bool top_left = tri.A[i] > 0 || (tri.A[i] == 0 && tri.B[i] > 0);
+        if (!top_left) {
+            tri.C[i] -= 1;
+        }
+    }
+
+    // Bounding box of the sample centers (X + 1/2) covered by the snapped triangle.
+    // Samples off the centers lie up to spread away from them.
+    int64_t half = SUBPIXEL_ONE / 2;
+    const int64_t spread = pattern ? pattern->max_offset : 0;
+    int64_t x_min = -floor_div(half + spread - std::min({X[0], X[1], X[2]}), SUBPIXEL_ONE);
+    int64_t x_max = floor_div(std::max({X[0], X[1], X[2]}) - half + spread, SUBPIXEL_ONE);
+    int64_t y_min = -floor_div(half + spread - std::min({Y[0], Y[1], Y[2]}), SUBPIXEL_ONE);
+    int64_t y_max = floor_div(std::max({Y[0], Y[1], Y[2]}) - half + spread, SUBPIXEL_ONE);
+    if (x_min > x_max || y_min > y_max) {
+        return CullResult::NoCoverage; // a sliver between two rows or columns of samples
+    }
+    tri.x_min = int(max(x_min, int64_t(0)));
+    tri.y_min = int(max(y_min, int64_t(0)));
+    tri.x_max = int(min(x_max, int64_t(width - 1)));
+    tri.y_max = int(min(y_max, int64_t(height - 1)));
+    if (tri.x_min > tri.x_max || tri.y_min > tri.y_max) {
+        return CullResult::Frustum;
+    }
+
+    // An edge function is linear, so its largest magnitude over the
+    // bounding box is found at one of the corners.
+    const int64_t MAX_EXACT = int64_t(1) << 53;
+    tri.exact_in_double = true;
+    for (int i = 0; i < 3; i++) {
+        for (int corner = 0; corner < 4; corner++) {
+            int64_t cx = corner & 1 ? tri.x_max * SUBPIXEL_ONE + half + spread : tri.x_min * SUBPIXEL_ONE + half - spread;
+            int64_t cy = corner & 2 ? tri.y_max * SUBPIXEL_ONE + half + spread : tri.y_min * SUBPIXEL_ONE + half - spread;
+            int64_t w = tri.A[i] * cx + tri.B[i] * cy + tri.C[i];
+            if (w >= MAX_EXACT || w <= -MAX_EXACT) {
+                tri.exact_in_double = false;
+            }
+        }
+    }
+
+    // Tiny triangles often fall between the samples of their bounding box
+    if (int64_t(tri.x_max - tri.x_min + 1) * (tri.y_max - tri.y_min + 1) <= 4) {
+        bool covers_sample = false;
+        for (int y = tri.y_min; y <= tri.y_max && !covers_sample; y++) {
+            for (int x = tri.x_min; x <= tri.x_max && !covers_sample; x++) {
+                int64_t sx = x * SUBPIXEL_ONE + half, sy = y * SUBPIXEL_ONE + half;
+                if (pattern) {
+                    int cell = (y % pattern->size) * pattern->size + x % pattern->size;
+                    sx += pattern->dx[cell];
+                    sy += pattern->dy[cell];
+                }
+                covers_sample = ((tri.A[0] * sx + tri.B[0] * sy + tri.C[0]) |
+                                 (tri.A[1] * sx + tri.B[1] * sy + tri.C[1]) |
+                                 (tri.A[2] * sx + tri.B[2] * sy + tri.C[2])) >= 0;
+            }
+        }
+        if (!covers_sample) {
+            return CullResult::NoCoverage;
+        }
+    }
+
+    int64_t w[3];
+    for (int i = 0; i < 3; i++) {
+        w[i] = tri.A[i] * (tri.x_min * SUBPIXEL_ONE + half) + tri.B[i] * (tri.y_min * SUBPIXEL_ONE + half) +
+               unbiased_C[i];
+    }
+    const Real inv_area = Real(1) / Real(sign * area);
+    tri.inv_w = setup_plane(tri, w, inv_area, inv_w);
+    tri.max_depth = T(std::max({inv_w[0], inv_w[1], inv_w[2]}));
+    tri.attributes = nullptr;
+    if (colors) {
+        for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+            Real values[3] = {colors[0][k] * inv_w[0], colors[1][k] * inv_w[1], colors[2][k] * inv_w[2]};
+            attribute_planes[k] = setup_plane(tri, w, inv_area, values);
+        }
+        tri.attributes = attribute_planes;
+    }
+    tri.normals = nullptr;
+    if (normals) {
+        for (int k = 0; k < 3; k++) {
+            Real values[3] = {normals[0][k] * inv_w[0], normals[1][k] * inv_w[1], normals[2][k] * inv_w[2]};
+            normal_planes[k] = setup_plane(tri, w, inv_area, values);
+        }
+        tri.normals = normal_planes;
+    }
+    return CullResult::Visible;
+}
+
+/**
+ * Check whether the CPU and the OS support AVX2
+ * @return True if AVX2 instructions can be executed
+ */
+bool cpu_supports_avx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#else
+    return false;
+#endif
+}
+
+/**
+ * Pick the pixel kernels for a SIMD mode, falling back to what the build and the CPU support
+ * @param mode The requested instruction set
+ * @return The kernels of every combination of features
+ */
+template <typename T>
+const RasterKernelTable<T> &select_kernels(SimdMode mode) {
+    if (mode == SimdMode::AVX2 && avx2_kernel_compiled() && cpu_supports_avx2()) {
+        return rasterize_triangle_avx2_kernels<T>();
+    }
+    if (mode != SimdMode::Scalar) {
+        return rasterize_triangle_sse_kernels<T>();
+    }
+    return rasterize_triangle_scalar_kernels<T>();
+}
+
+/**
+ * Pick the vertical pass of the resolve for a SIMD mode, like select_kernels
+ * @param mode The requested instruction set
+ * @return The kernel
+ */
+template <typename T>
+FilterRowsKernel<T> select_filter_rows(SimdMode mode) {
+    if (mode == SimdMode::AVX2 && avx2_kernel_compiled() && cpu_supports_avx2()) {
+        return filter_rows_avx2<T>;
+    }
+    if (mode != SimdMode::Scalar) {
+        return filter_rows_sse<T>;
+    }
+    return filter_rows_scalar<T>;
+}
+
+/**
+ * Pick the lighting kernel for a SIMD mode, like select_kernels
+ * @param mode The requested instruction set
+ * @return The kernel
+ */
+ShadeLightsKernel select_shade_lights(SimdMode mode) {
+    if (mode == SimdMode::AVX2 && avx2_kernel_compiled() && cpu_supports_avx2()) {
+        return shade_lights_avx2;
+    }
+    if (mode != SimdMode::Scalar) {
+        return shade_lights_sse;
+    }
+    return shade_lights_scalar;
+}
+
+/**
+ * Pick the depth-only kernel for a SIMD mode, like select_kernels
+ * @param mode The requested instruction set
+ * @return The kernel
+ */
+DepthKernel select_depth_kernel(SimdMode mode) {
+    if (mode == SimdMode::AVX2 && avx2_kernel_compiled() && cpu_supports_avx2()) {
+        return rasterize_depth_avx2;
+    }
+    if (mode != SimdMode::Scalar) {
+        return rasterize_depth_sse;
+    }
+    return rasterize_depth_scalar;
+}
+
+/// A screen tile split into square blocks of samples, with the levels of the
+/// hierarchical Z-buffer over it: the farthest depth of every block and of
+/// the whole tile. Depth only grows towards the viewer, so anything with a
+/// nearest depth not above the farthest depth of a region is hidden there.
+/// The entries are refreshed lazily from the depth buffer on the first
+/// lookup after a write, so rasterization only has to mark them dirty.
+/// The buffers are cleared lazily too, a block at a time on its first write
+/// (see clear_block), so blocks no triangle reaches are never touched.
+template <typename T>
+struct HiZTile {
+    int x0, y0, x1, y1; // the samples [x0, x1) x [y0, y1) of the tile
+    int block_size; // edge length of a block in samples
+    int blocks_x; // blocks per row of the tile
+    std::vector<float> block_far; // in the precision of the depth buffer
+    std::vector<uint8_t> block_dirty;
+    std::vector<uint8_t> block_skipped; // blocks left out of rasterization, empty if none are
+    std::vector<uint8_t> block_clear; // blocks not written yet, whose buffers hold stale samples
+    float tile_far;
+    bool tile_dirty;
+
+    HiZTile(int x0, int y0, int x1, int y1, int block_size)
+            : x0(x0), y0(y0), x1(x1), y1(y1), block_size(block_size) {
+        blocks_x = (x1 - x0 + block_size - 1) / block_size;
+        int blocks_y = (y1 - y0 + block_size - 1) / block_size;
+        // the tile starts out cleared to the farthest depth
+        block_far.assign(blocks_x * blocks_y, -std::numeric_limits<float>::infinity());
+        block_dirty.assign(blocks_x * blocks_y, 0);
+        block_clear.assign(blocks_x * blocks_y, 1);
+        tile_far = -std::numeric_limits<float>::infinity();
+        tile_dirty = false;
+    }
+};
+
+/**
+ * The block holding a sample
+ * @param hiz The tile
+ * @param x The column of the sample
+ * @param y The row of the sample
+ * @return The block index within the tile
+ */
+template <typename T>
+int block_at(const HiZTile<T> &hiz, int x, int y) {
+    return (y - hiz.y0) / hiz.block_size * hiz.blocks_x + (x - hiz.x0) / hiz.block_size;
+}
+
+/**
+ * Clear the buffers of a block before its first write: color to the
+ * background, depth to the farthest and ids to no triangle, or with MSAA
+ * every pixel to a single background slot. A block never written is never
+ * cleared, and its pixels are resolved to the background directly.
+ * @param hiz The tile
+ * @param block The block index within the tile
+ * @param target The buffers behind the tile
+ */
+template <typename T>
+void clear_block(HiZTile<T> &hiz, int block, const RasterTarget<T> &target) {
+    const int bx0 = hiz.x0 + (block % hiz.blocks_x) * hiz.block_size;
+    const int by0 = hiz.y0 + (block / hiz.blocks_x) * hiz.block_size;
+    const int bx1 = min(bx0 + hiz.block_size, hiz.x1);
+    const int by1 = min(by0 + hiz.block_size, hiz.y1);
+    for (int y = by0; y < by1; y++) {
+        int64_t index = int64_t(y - target.y0) * target.width + (bx0 - target.x0);
+        std::fill_n(target.depth + index, bx1 - bx0, -std::numeric_limits<float>::infinity());
+        if (target.ids) {
+            std::fill_n(target.ids + index, bx1 - bx0, NO_TRIANGLE);
+        }
+        if (target.color) {
+            std::fill_n(target.color + int64_t(y - target.y0) * target.color_width + (bx0 - target.x0),
+                        bx1 - bx0, target.background);
+        }
+    }
+    if (!target.color) {
+        // With MSAA blocks cover whole pixels
+        const int AA = target.aa_factor;
+        const uint64_t all_samples = AA == 8 ? ~uint64_t(0) : (uint64_t(1) << (AA * AA)) - 1;
+        for (int py = (by0 - target.y0) / AA; py < (by1 - target.y0) / AA; py++) {
+            for (int px = (bx0 - target.x0) / AA; px < (bx1 - target.x0) / AA; px++) {
+                MsaaPixel<T> &pixel = target.pixels[py * target.pixel_width + px];
+                for (int s = 0; s < MSAA_SLOTS; s++) {
+                    pixel.color[s] = target.background;
+                    pixel.mask[s] = s == 0 ? all_samples : 0;
+                }
+            }
+        }
+    }
+    hiz.block_clear[block] = 0;
+}
+
+/**
+ * Look up the farthest depth of a block, refreshing it if it was written to
+ * @param hiz The tile
+ * @param block The block index within the tile
+ * @param target The depth buffer behind the tile
+ * @return The smallest depth stored in the block
+ */
+template <typename T>
+float block_farthest(HiZTile<T> &hiz, int block, const RasterTarget<T> &target) {
+    if (hiz.block_dirty[block]) {
+        int bx0 = hiz.x0 + (block % hiz.blocks_x) * hiz.block_size;
+        int by0 = hiz.y0 + (block / hiz.blocks_x) * hiz.block_size;
+        int bx1 = min(bx0 + hiz.block_size, hiz.x1);
+        int by1 = min(by0 + hiz.block_size, hiz.y1);
+        float farthest = std::numeric_limits<float>::infinity();
+        for (int y = by0; y < by1; y++) {
+            const float *row = target.depth + int64_t(y - target.y0) * target.width;
+            for (int x = bx0; x < bx1; x++) {
+                farthest = min(farthest, row[x - target.x0]);
+            }
+        }
+        hiz.block_far[block] = farthest;
+        hiz.block_dirty[block] = 0;
+    }
+    return hiz.block_far[block];
+}
+
+/**
+ * Look up the farthest depth of a whole tile, refreshing it if it was written to
+ * @param hiz The tile
+ * @param target The depth buffer behind the tile
+ * @return The smallest depth stored in the tile
+ */
+template <typename T>
+float tile_farthest(HiZTile<T> &hiz, const RasterTarget<T> &target) {
+    if (hiz.tile_dirty) {
+        float farthest = std::numeric_limits<float>::infinity();
+        for (int block = 0; block < (int)hiz.block_far.size(); block++) {
+            farthest = min(farthest, block_farthest(hiz, block, target));
+            if (farthest == -std::numeric_limits<float>::infinity()) {
+                break; // some block is still empty
+            }
+        }
+        hiz.tile_far = farthest;
+        hiz.tile_dirty = false;
+    }
+    return hiz.tile_far;
+}
+
+/**
+ * Rasterize the part of a triangle inside a tile, testing blocks of samples
+ * against the edges before the samples themselves. Blocks outside an edge are skipped,
+ * blocks inside all three edges are drawn without per-sample coverage tests,
+ * and only the blocks crossing an edge go through the per-sample tests.
+ * With occlusion culling, the triangle is also tested against the Hi-Z of the tile
+ * and of every block before it is rasterized there.
+ * Blocks marked in hiz.block_skipped are left out altogether, and the others are
+ * cleared on their first write.
+ * @param tri The triangle
+ * @param x_min The first column to rasterize
+ * @param x_max The last column to rasterize
+ * @param y_min The first row to rasterize
+ * @param y_max The last row to rasterize
+ * @param hiz The tile holding the rectangle
+ * @param occlusion_culling Skip the tile and blocks the Hi-Z shows the triangle is hidden in
+ * @param kernels The pixel kernels drawing the samples of a block
+ * @param features The KernelFeatures fixed over the frame; the block adds the others
+ * @param target The super-sampled color and depth buffers
+ * @param stats The counters to update
+ */
+template <typename T>
+void rasterize_triangle_blocks(const ScreenTriangle<T> &tri, int x_min, int x_max, int y_min, int y_max,
+                               HiZTile<T> &hiz, bool occlusion_culling, const RasterKernelTable<T> &kernels,
+                               int features, const RasterTarget<T> &target, RasterStats &stats) {
+    if (occlusion_culling && tri.max_depth <= tile_farthest(hiz, target)) {
+        stats.triangles_occluded++;
+        return;
+    }
+    stats.triangles++;
+
+    const int64_t half = SUBPIXEL_ONE / 2;
+    const int block_size = hiz.block_size;
+    const int bx_min = (x_min - hiz.x0) / block_size, bx_max = (x_max - hiz.x0) / block_size;
+    const int by_min = (y_min - hiz.y0) / block_size, by_max = (y_max - hiz.y0) / block_size;
+    for (int by = by_min; by <= by_max; by++) {
+        int y0 = max(hiz.y0 + by * block_size, y_min);
+        int y1 = min(hiz.y0 + (by + 1) * block_size - 1, y_max);
+        for (int bx = bx_min; bx <= bx_max; bx++) {
+            int x0 = max(hiz.x0 + bx * block_size, x_min);
+            int x1 = min(hiz.x0 + (bx + 1) * block_size - 1, x_max);
+            int block = by * hiz.blocks_x + bx;
+            if (!hiz.block_skipped.empty() && hiz.block_skipped[block]) {
+                continue;
+            }
+
+            // The edge functions are linear, so their range over the
+            // samples of the block is spanned by the corner samples.
+            // Samples off the cell centers widen that range by at most slack.
+            bool outside = false, inside = true;
+            for (int i = 0; i < 3 && !outside; i++) {
+                int64_t w = tri.A[i] * (x0 * SUBPIXEL_ONE + half) +
+                            tri.B[i] * (y0 * SUBPIXEL_ONE + half) + tri.C[i];
+                int64_t dx = tri.A[i] * (x1 - x0) * SUBPIXEL_ONE;
+                int64_t dy = tri.B[i] * (y1 - y0) * SUBPIXEL_ONE;
+                int64_t slack = target.pattern ?
+                    (std::abs(tri.A[i]) + std::abs(tri.B[i])) * target.pattern->max_offset : 0;
+                int64_t w_max = w + max(dx, int64_t(0)) + max(dy, int64_t(0)) + slack;
+                int64_t w_min = w + min(dx, int64_t(0)) + min(dy, int64_t(0)) - slack;
+                outside = w_max < 0;
+                inside = inside && w_min >= 0;
+            }
+            stats.edge_tests += 3;
+            if (outside) {
+                stats.blocks_rejected++;
+                continue;
+            }
+
+            if (occlusion_culling && tri.max_depth <= block_farthest(hiz, block, target)) {
+                stats.blocks_occluded++;
+                continue;
+            }
+            if (inside) {
+                stats.blocks_accepted++;
+            } else {
+                stats.blocks_partial++;
+                stats.edge_tests += 3 * int64_t(x1 - x0 + 1) * (y1 - y0 + 1);
+            }
+            // Every sample passes the depth test of a block just cleared
+            int block_features = features | (inside ? KERNEL_COVERED : 0);
+            if (hiz.block_clear[block]) {
+                clear_block(hiz, block, target);
+                stats.blocks_cleared++;
+            } else {
+                block_features |= KERNEL_DEPTH_TEST;
+            }
+            int64_t written = kernels[block_features](tri, x0, x1, y0, y1, target);
+            if (target.ids) {
+                stats.visibility_writes += written;
+            } else {
+                stats.shaded += written;
+            }
+            hiz.block_dirty[block] = 1;
+            hiz.tile_dirty = true;
+        }
+    }
+}
+
+/// The shadow map of a directional light: the depth of the scene along the
+/// light, in an orthographic projection fitted around the whole scene.
+struct ShadowMap {
+    std::vector<float> depth; // in the tiled layout of map
+    DepthMap map;
+    // from camera space to (x, y) in samples of the map, and z the depth
+    // along the light, larger nearer to it as in map
+    Matrix4x4 from_camera;
+    // against self-shadowing: how far a point is moved along its normal,
+    // and the depth added to it, before it is tested
+    Real normal_offset, bias;
+};
+
+/**
+ * Percentage-closer filtering: how much of a light reaches a point, from the
+ * depth tests of the point against the samples of the shadow map around it
+ * @param shadow The shadow map of the light
+ * @param point The point in camera space
+ * @param normal The unit normal at the point in camera space
+ * @param radius The filter covers (2 * radius + 1)^2 samples
+ * @return The fraction of the samples the point is not behind, from 0 in the shadow to 1
+ */
+float shadow_visibility(const ShadowMap &shadow, const Vector3 &point, const Vector3 &normal, int radius) {
+    const Vector3 p = point + shadow.normal_offset * normal;
+    const Matrix4x4 &m = shadow.from_camera;
+    const Real sx = m(0, 0) * p.x + m(0, 1) * p.y + m(0, 2) * p.z + m(0, 3);
+    const Real sy = m(1, 0) * p.x + m(1, 1) * p.y + m(1, 2) * p.z + m(1, 3);
+    const float depth = float(m(2, 0) * p.x + m(2, 1) * p.y + m(2, 2) * p.z + m(2, 3) + shadow.bias);
+    // The sample whose cell holds the point, and the ones around it.
+    // Samples off the map hold nothing, so they never shadow.
+    const int cx = int(std::floor(sx)), cy = int(std::floor(sy));
+    const DepthMap &map = shadow.map;
+    const int x0 = max(cx - radius, 0), x1 = min(cx + radius, map.width - 1);
+    const int y0 = max(cy - radius, 0), y1 = min(cy + radius, map.height - 1);
+    const int taps = (2 * radius + 1) * (2 * radius + 1);
+    int lit = taps - max(x1 - x0 + 1, 0) * max(y1 - y0 + 1, 0);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            lit += depth >= map.depth[map.index(x, y)];
+        }
+    }
+    return float(lit) / float(taps);
+}
+
+/// What the deferred shading of a frame needs besides the triangles.
+struct DeferredShading {
+    bool flat; // the face colors instead of interpolated vertex colors
+    const SampleOffsets *pattern; // null for the grid pattern
+    TextureFilter texture_filter;
+    // the lights in camera space, none if the frame is unlit, and the kernel lighting the fragments
+    std::vector<ShadingLight> lights;
+    ShadeLightsKernel shade_lights;
+    // the camera space ray through the super-sample position (sx, sy) is
+    // (view_scale_x * sx + view_offset_x, view_scale_y * sy + view_offset_y, -1)
+    Real view_scale_x, view_offset_x, view_scale_y, view_offset_y;
+    // the shadow map of every light, none without shadows, and the radius of their filter
+    std::vector<ShadowMap> shadows;
+    int pcf_radius;
+    int aa_factor; // samples per pixel along each axis
+};
+
+/// Pixels per side of the shadow visibility cache of a LitBatch.
+constexpr int SHADOW_CACHE_SIZE = 32;
+
+/// Lit fragments queued for the lighting kernel, with where their colors go.
+template <typename T>
+struct LitBatch {
+    static constexpr int CAPACITY = 256; // a multiple of the 8 lanes of the kernels
+    float albedo[3][CAPACITY] = {}, normal[3][CAPACITY] = {}, view[2][CAPACITY] = {};
+    float shininess[CAPACITY] = {}, color[3][CAPACITY] = {};
+    std::vector<float> shadow; // CAPACITY per light with shadows, else empty
+    // the visibility of the lights last computed in a pixel, for a triangle,
+    // direct-mapped by the position of the pixel; empty without shadows
+    std::vector<int64_t> cached_pixel; // -1 when unused
+    std::vector<uint32_t> cached_triangle;
+    std::vector<float> cached_visibility; // per light
+    TVector3<T> *out[CAPACITY];
+    int count = 0;
+};
+
+/**
+ * Evaluate an attribute plane of a triangle at a sample, as the kernels do
+ * @param plane The plane
+ * @param tri The triangle
+ * @param x The column of the sample
+ * @param y The row of the sample
+ * @param pattern The sample offsets, or null for the grid pattern
+ * @return The value of the plane
+ */
+template <typename T>
+T evaluate_plane(const AttributePlane<T> &plane, const ScreenTriangle<T> &tri, int x, int y,
+                 const SampleOffsets *pattern) {
+    T value = plane.row(y - tri.y_min) + plane.dx * T(x - tri.x_min);
+    if (pattern) {
+        const int cell = (y % pattern->size) * pattern->size + x % pattern->size;
+        value = value + plane.shift(T(pattern->fx[cell]), T(pattern->fy[cell]));
+    }
+    return value;
+}
+
+/**
+ * Compute the color of a triangle at a sample it won, before lighting
+ * @param tri The triangle
+ * @param x The column of the sample
+ * @param y The row of the sample
+ * @param shading The shading of the frame
+ * @return The color, exactly as the kernels compute it for untextured triangles
+ */
+template <typename T>
+TVector3<T> shade_sample(const ScreenTriangle<T> &tri, int x, int y, const DeferredShading &shading) {
+    if (shading.flat) {
+        return tri.color;
+    }
+    // The depth is evaluated again in T rather than read back from the
+    // float buffer, so the colors keep the precision of the kernels
+    T w = T(1) / evaluate_plane(tri.inv_w, tri, x, y, shading.pattern);
+    TVector3<T> color;
+    for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+        color[k] = evaluate_plane(tri.attributes[k], tri, x, y, shading.pattern) * w;
+    }
+    if (tri.texture) {
+        // The first two attributes are (u, v). Differentiating u = (u/w) / (1/w)
+        // gives its screen-space derivatives at the sample, in texture
+        // coordinates per super-sample.
+        const T u = color[0], v = color[1];
+        const AttributePlane<T> &plane_u = tri.attributes[0], &plane_v = tri.attributes[1];
+        Real dudx = Real((plane_u.dx - u * tri.inv_w.dx) * w), dudy = Real((plane_u.dy - u * tri.inv_w.dy) * w);
+        Real dvdx = Real((plane_v.dx - v * tri.inv_w.dx) * w), dvdy = Real((plane_v.dy - v * tri.inv_w.dy) * w);
+        Real lod = mip_level(*tri.texture, dudx, dvdx, dudy, dvdy);
+        color = TVector3<T>(sample_texture(*tri.texture, Real(u), Real(v), lod, shading.texture_filter));
+    }
+    return color;
+}
+
+/**
+ * Light the queued fragments and write their colors out
+ * @param batch The fragments, emptied
+ * @param shading The shading of the frame
+ */
+template <typename T>
+void flush_lit_batch(LitBatch<T> &batch, const DeferredShading &shading) {
+    if (batch.count == 0) {
+        return;
+    }
+    const LitFragments fragments{{batch.albedo[0], batch.albedo[1], batch.albedo[2]},
+                                 {batch.normal[0], batch.normal[1], batch.normal[2]},
+                                 {batch.view[0], batch.view[1]},
+                                 batch.shininess,
+                                 batch.shadow.empty() ? nullptr : batch.shadow.data(),
+                                 LitBatch<T>::CAPACITY,
+                                 {batch.color[0], batch.color[1], batch.color[2]}};
+    shading.shade_lights(fragments, batch.count, shading.lights.data(), (int)shading.lights.size());
+    for (int i = 0; i < batch.count; i++) {
+        *batch.out[i] = TVector3<T>{T(batch.color[0][i]), T(batch.color[1][i]), T(batch.color[2][i])};
+    }
+    batch.count = 0;
+}
+
+/**
+ * Shade a sample a triangle won. Unlit colors are written right away; lit
+ * ones are queued, and written when the batch is flushed.
+ * @param tri The triangle
+ * @param x The column of the sample
+ * @param y The row of the sample
+ * @param shading The shading of the frame
+ * @param batch The queue of lit fragments
+ * @param out Where the color goes
+ */
+template <typename T>
+void shade_deferred(const ScreenTriangle<T> &tri, int x, int y, const DeferredShading &shading,
+                    LitBatch<T> &batch, TVector3<T> *out) {
+    TVector3<T> albedo = shade_sample(tri, x, y, shading);
+    if (!tri.normals) {
+        *out = albedo;
+        return;
+    }
+    const int i = batch.count;
+    T w = T(1) / evaluate_plane(tri.inv_w, tri, x, y, shading.pattern);
+    for (int k = 0; k < 3; k++) {
+        batch.albedo[k][i] = float(albedo[k]);
+        batch.normal[k][i] = float(evaluate_plane(tri.normals[k], tri, x, y, shading.pattern) * w);
+    }
+    Real sx = x + Real(0.5), sy = y + Real(0.5);
+    if (shading.pattern) {
+        const int cell = (y % shading.pattern->size) * shading.pattern->size + x % shading.pattern->size;
+        sx += shading.pattern->fx[cell];
+        sy += shading.pattern->fy[cell];
+    }
+    const Real view_x = shading.view_scale_x * sx + shading.view_offset_x;
+    const Real view_y = shading.view_scale_y * sy + shading.view_offset_y;
+    batch.view[0][i] = float(view_x);
+    batch.view[1][i] = float(view_y);
+    if (!shading.shadows.empty()) {
+        // The filter of the shadow maps is wider than a pixel, so the
+        // visibility is computed at the first sample a triangle wins in a
+        // pixel, and reused by its other samples there
+        const int num_lights = (int)shading.shadows.size();
+        const int px = x / shading.aa_factor, py = y / shading.aa_factor;
+        const int slot = (py % SHADOW_CACHE_SIZE) * SHADOW_CACHE_SIZE + px % SHADOW_CACHE_SIZE;
+        const int64_t pixel = (int64_t(py) << 32) | px;
+        float *visibility = &batch.cached_visibility[int64_t(slot) * num_lights];
+        if (batch.cached_pixel[slot] != pixel || batch.cached_triangle[slot] != tri.id) {
+            // The fragment lies on its ray at distance w along the view direction
+            const Vector3 p{view_x * Real(w), view_y * Real(w), -Real(w)};
+            Vector3 n{batch.normal[0][i], batch.normal[1][i], batch.normal[2][i]};
+            n = n / max(length(n), Real(1e-30));
+            for (int l = 0; l < num_lights; l++) {
+                visibility[l] = shadow_visibility(shading.shadows[l], p, n, shading.pcf_radius);
+            }
+            batch.cached_pixel[slot] = pixel;
+            batch.cached_triangle[slot] = tri.id;
+        }
+        for (int l = 0; l < num_lights; l++) {
+            batch.shadow[l * LitBatch<T>::CAPACITY + i] = visibility[l];
+        }
+    }
+    batch.shininess[i] = tri.shininess;
+    batch.out[i] = out;
+    if (++batch.count == LitBatch<T>::CAPACITY) {
+        flush_lit_batch(batch, shading);
+    }
+}
+
+/**
+ * Shade the samples of a tile from its visibility buffer, each covered sample once.
+ * The colors are reconstructed from the planes of the triangle that won the
+ * sample, exactly as the kernels would have computed them, then textured and
+ * lit if the triangle is.
+ * Blocks never written hold no triangle and are skipped.
+ * @param triangles The triangles of the frame, indexed by the ids in the buffer
+ * @param target The super-sampled color, depth and id buffers of the tile
+ * @param hiz The tile
+ * @param shading The shading of the frame
+ * @param batch Scratch for the lit fragments
+ * @return The number of samples shaded
+ */
+template <typename T>
+int64_t shade_visibility_buffer(const std::vector<ScreenTriangle<T>> &triangles, const RasterTarget<T> &target,
+                                const HiZTile<T> &hiz, const DeferredShading &shading, LitBatch<T> &batch) {
+    // Which sample of a pixel comes first depends only on the tile
+    std::fill(batch.cached_pixel.begin(), batch.cached_pixel.end(), -1);
+    int64_t shaded = 0;
+    for (int block = 0; block < (int)hiz.block_clear.size(); block++) {
+        if (hiz.block_clear[block]) {
+            continue;
+        }
+        const int bx0 = hiz.x0 + (block % hiz.blocks_x) * hiz.block_size;
+        const int by0 = hiz.y0 + (block / hiz.blocks_x) * hiz.block_size;
+        for (int y = by0; y < min(by0 + hiz.block_size, hiz.y1); y++) {
+            for (int x = bx0; x < min(bx0 + hiz.block_size, hiz.x1); x++) {
+                int64_t index = int64_t(y - target.y0) * target.width + (x - target.x0);
+                if (target.ids[index] == NO_TRIANGLE) {
+                    continue;
+                }
+                shade_deferred(triangles[target.ids[index]], x, y, shading, batch,
+                               &target.color[int64_t(y - target.y0) * target.color_width + (x - target.x0)]);
+                shaded++;
+            }
+        }
+    }
+    flush_lit_batch(batch, shading);
+    return shaded;
+}
+
+/**
+ * Depth test a triangle at one sample per pixel, the sample at
+ * (aa_factor / 2, aa_factor / 2) within the pixel, writing its depth and the
+ * triangle id. This is the first pass of edge-adaptive anti-aliasing: the
+ * samples are those of the super-sampled grid, so they see exactly the
+ * coverage and depth the full-rate kernels would.
+ * @param tri The triangle
+ * @param target The per-pixel depth and id buffers; x0 and y0 are in pixels
+ * @param x1 One past the last pixel column of the target
+ * @param y1 One past the last pixel row of the target
+ * @return The number of pixels written
+ */
+template <typename T>
+int64_t rasterize_triangle_pixels(const ScreenTriangle<T> &tri, const RasterTarget<T> &target, int x1, int y1) {
+    const int AA = target.aa_factor, offset = target.aa_factor / 2;
+    // the pixels whose sample lies inside the bounding box
+    const int px_min = max(int(floor_div(tri.x_min - offset + AA - 1, AA)), target.x0);
+    const int px_max = min(int(floor_div(tri.x_max - offset, AA)), x1 - 1);
+    const int py_min = max(int(floor_div(tri.y_min - offset + AA - 1, AA)), target.y0);
+    const int py_max = min(int(floor_div(tri.y_max - offset, AA)), y1 - 1);
+
+    // the sample sits in the same cell of every pixel
+    const int64_t half = SUBPIXEL_ONE / 2;
+    const int cell = offset * AA + offset;
+    const int64_t sample_dx = target.pattern ? target.pattern->dx[cell] : 0;
+    const int64_t sample_dy = target.pattern ? target.pattern->dy[cell] : 0;
+    const T inv_w_shift = target.pattern ?
+        tri.inv_w.shift(T(target.pattern->fx[cell]), T(target.pattern->fy[cell])) : T(0);
+    int64_t step_x[3], w_row[3];
+    for (int i = 0; i < 3; i++) {
+        step_x[i] = tri.A[i] * AA * SUBPIXEL_ONE;
+        w_row[i] = tri.A[i] * ((px_min * AA + offset) * SUBPIXEL_ONE + half + sample_dx) +
+                   tri.B[i] * ((py_min * AA + offset) * SUBPIXEL_ONE + half + sample_dy) + tri.C[i];
+    }
+    int64_t written = 0;
+    for (int py = py_min; py <= py_max; py++) {
+        int64_t w0 = w_row[0], w1 = w_row[1], w2 = w_row[2];
+        T inv_w_row = tri.inv_w.row(py * AA + offset - tri.y_min);
+        for (int px = px_min; px <= px_max; px++) {
+            if ((w0 | w1 | w2) >= 0) {
+                T depth = inv_w_row + tri.inv_w.dx * T(px * AA + offset - tri.x_min);
+                if (target.pattern) {
+                    depth = depth + inv_w_shift;
+                }
+                const float stored = float(depth);
+                int64_t index = int64_t(py - target.y0) * target.width + (px - target.x0);
+                if (stored > target.depth[index]) {
+                    target.depth[index] = stored;
+                    target.ids[index] = tri.id;
+                    written++;
+                }
+            }
+            w0 += step_x[0];
+            w1 += step_x[1];
+            w2 += step_x[2];
+        }
+        for (int i = 0; i < 3; i++) {
+            w_row[i] += tri.B[i] * AA * SUBPIXEL_ONE;
+        }
+    }
+    return written;
+}
+
+/// Vertices processed in one batch by transform_vertices.
+constexpr int VERTEX_BATCH = 256;
+
+/// A mesh with one of the transforms it is drawn with. The vertex stage runs
+/// once per draw, so a mesh with instances is transformed once per instance
+/// while all of them read the same geometry.
+struct MeshDraw {
+    const TriangleMesh *mesh;
+    const Matrix4x4 *model_matrix;
+    const Vector3 *color; // replaces the vertex colors of the mesh, or nullptr
+};
+
+/**
+ * List the draws of a scene: one per mesh, or one per instance of the meshes that have instances
+ * @param scene The scene
+ * @return The draws, in the order of the meshes and their instances
+ */
+std::vector<MeshDraw> mesh_draws(const Scene &scene) {
+    std::vector<MeshDraw> draws;
+    for (const TriangleMesh &mesh : scene.meshes) {
+        if (mesh.instances.empty()) {
+            draws.push_back(MeshDraw{&mesh, &mesh.model_matrix, nullptr});
+        }
+        for (const MeshInstance &instance : mesh.instances) {
+            draws.push_back(MeshDraw{&mesh, &instance.model_matrix, instance.color ? &*instance.color : nullptr});
+        }
+    }
+    return draws;
+}
+
+/// The vertices of a mesh after vertex processing.
+struct ProcessedVertices {
+    std::vector<Vector3> camera; // positions in camera space
+    std::vector<Vector3> normals; // normals in camera space, only when the frame is lit
+    std::vector<Real> screen_x, screen_y; // positions on the super-sampled screen
+    std::vector<uint16_t> outcodes; // the frustum planes each vertex lies outside of
+};
+
+/**
+ * Transform the vertices of a mesh to camera and screen space, each vertex once.
+ * The screen positions are written as separate x and y arrays so that a batch
+ * runs the same arithmetic over contiguous lanes. They equal
+ * toScreenSpace(project(transform_point(model_view, v)), ...) exactly,
+ * and are only meaningful for vertices in front of the camera.
+ * @param vertices The vertices in object space
+ * @param model_view The object to camera transform
+ * @param frustum The view frustum, for the outcodes
+ * @param width The width of the screen
+ * @param height The height of the screen
+ * @param s The scaling factor of the view frustum
+ * @param out The processed vertices
+ * @param num_threads The number of worker threads
+ */
+void transform_vertices(const std::vector<Vector3> &vertices, const Matrix4x4 &model_view,
+                        const Frustum &frustum, int width, int height, Real s,
+                        ProcessedVertices &out, int num_threads) {
+    const int64_t num_vertices = (int64_t)vertices.size();
+    out.camera.resize(num_vertices);
+    out.screen_x.resize(num_vertices);
+    out.screen_y.resize(num_vertices);
+    out.outcodes.resize(num_vertices);
+    const Real aspect_ratio = static_cast<float>(width) / height;
+    const Real offset_x = aspect_ratio * s, extent_x = 2 * aspect_ratio * s;
+    parallel_for([&](int64_t batch) {
+        const int64_t begin = batch * VERTEX_BATCH;
+        const int64_t end = min(begin + VERTEX_BATCH, num_vertices);
+        // Camera space x / z and y / z, in the output arrays
+        Real *px = out.screen_x.data(), *py = out.screen_y.data();
+        for (int64_t i = begin; i < end; i++) {
+            const Vector3 &v = vertices[i];
+            Real x = model_view(0, 0) * v.x + model_view(0, 1) * v.y + model_view(0, 2) * v.z + model_view(0, 3);
+            Real y = model_view(1, 0) * v.x + model_view(1, 1) * v.y + model_view(1, 2) * v.z + model_view(1, 3);
+            Real z = model_view(2, 0) * v.x + model_view(2, 1) * v.y + model_view(2, 2) * v.z + model_view(2, 3);
+            Real w = model_view(3, 0) * v.x + model_view(3, 1) * v.y + model_view(3, 2) * v.z + model_view(3, 3);
+            out.camera[i] = Vector3{x / w, y / w, z / w};
+            px[i] = -out.camera[i].x / out.camera[i].z;
+            py[i] = -out.camera[i].y / out.camera[i].z;
+        }
+        for (int64_t i = begin; i < end; i++) {
+            px[i] = width * (px[i] + offset_x) / extent_x;
+            py[i] = height * (1 - (py[i] + s) / (2 * s)); // y-axis is flipped
+        }
+        for (int64_t i = begin; i < end; i++) {
+            out.outcodes[i] = uint16_t(frustum.outcode(out.camera[i]));
+        }
+    }, (num_vertices + VERTEX_BATCH - 1) / VERTEX_BATCH, num_threads);
+}
+
+/// Triangle indices binned into screen tiles, stored as one
+/// compressed list per contiguous range of input triangles.
+/// Keeping the ranges separate lets them be filled in parallel,
+/// and walking them in order preserves the submission order per tile.
+struct TileBins {
+    int num_tiles;
+    std::vector<int> offsets; // (num_tiles + 1) offsets into indices
+    std::vector<int> indices;
+};
+
+/**
+ * Bin triangles into the tiles their bounding boxes overlap,
+ * one TileBins per contiguous range of the drawing order, in parallel
+ * @param triangles The triangles
+ * @param culling Which triangles are visible; the others are left out
+ * @param draw_order The drawing order, or null for the order of the triangles
+ * @param tile_size The edge length of a tile in samples
+ * @param num_tiles_x The number of tiles per row
+ * @param num_tiles The number of tiles
+ * @param num_threads The number of worker threads, 0 = all cores
+ * @return The bins, to be walked in order
+ */
+template <typename T>
+std::vector<TileBins> bin_triangles(const std::vector<ScreenTriangle<T>> &triangles,
+                                    const std::vector<CullResult> &culling, const std::vector<int> *draw_order,
+                                    int tile_size, int num_tiles_x, int num_tiles, int num_threads) {
+    const int num_drawn = draw_order ? (int)draw_order->size() : (int)triangles.size();
+    const int num_bins = max(min(num_threads > 0 ? num_threads : num_system_cores(), num_drawn), 1);
+    std::vector<TileBins> bins(num_bins);
+    parallel_for([&](int64_t bin_id) {
+        TileBins &bin = bins[bin_id];
+        int begin = int(int64_t(num_drawn) * bin_id / num_bins);
+        int end = int(int64_t(num_drawn) * (bin_id + 1) / num_bins);
+        auto for_each_tile = [&](int i, auto &&func) {
+            if (culling[i] != CullResult::Visible) {
+                return;
+            }
+            const ScreenTriangle<T> &tri = triangles[i];
+            for (int ty = tri.y_min / tile_size; ty <= tri.y_max / tile_size; ty++) {
+                for (int tx = tri.x_min / tile_size; tx <= tri.x_max / tile_size; tx++) {
+                    func(ty * num_tiles_x + tx);
+                }
+            }
+        };
+        // Counting sort by tile, keeping the triangle order within each tile.
+        bin.num_tiles = num_tiles;
+        bin.offsets.assign(num_tiles + 1, 0);
+        auto triangle_at = [&](int j) {
+            return draw_order ? (*draw_order)[j] : j;
+        };
+        for (int j = begin; j < end; j++) {
+            for_each_tile(triangle_at(j), [&](int tile) { bin.offsets[tile + 1]++; });
+        }
+        for (int t = 0; t < num_tiles; t++) {
+            bin.offsets[t + 1] += bin.offsets[t];
+        }
+        bin.indices.resize(bin.offsets[num_tiles]);
+        std::vector<int> cursor(bin.offsets.begin(), bin.offsets.end() - 1);
+        for (int j = begin; j < end; j++) {
+            const int i = triangle_at(j);
+            for_each_tile(i, [&](int tile) { bin.indices[cursor[tile]++] = i; });
+        }
+    }, num_bins, num_threads);
+    return bins;
+}
+
+/// Edge length of the tiles the shadow maps are binned into, in samples.
+constexpr int SHADOW_TILE_SIZE = 8 * DEPTH_TILE_SIZE;
+
+/**
+ * Render the shadow map of a directional light. The scene is projected along
+ * the light onto a square fitted around its bounding box there, so that
+ * meshes out of view cast their shadows too. The triangles go through the
+ * setup and binning of the frame with their depth along the light in place
+ * of 1/w, which needs no perspective correction in an orthographic
+ * projection, and through the depth-only kernel.
+ * @param scene The scene
+ * @param direction The unit vector towards the light in world space
+ * @param options The rasterizer settings, for the size and filter of the map and the threads
+ * @param stats The work counters
+ * @return The shadow map
+ */
+ShadowMap render_shadow_map(const Scene &scene, const Vector3 &direction, const RenderOptions &options,
+                            RasterStats &stats) {
+    // Light space: x and y across the light, z towards it
+    const Vector3 axis_z = direction;
+    const Vector3 up = std::abs(axis_z.y) < Real(0.9) ? Vector3{0, 1, 0} : Vector3{1, 0, 0};
+    const Vector3 axis_x = normalize(cross(up, axis_z));
+    const Vector3 axis_y = cross(axis_z, axis_x);
+    const std::vector<MeshDraw> draws = mesh_draws(scene);
+    const int num_draws = (int)draws.size();
+    std::vector<std::vector<Vector3>> light_space(num_draws);
+    Vector3 box_min = Vector3{1, 1, 1} * std::numeric_limits<Real>::infinity();
+    Vector3 box_max = -box_min;
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        const TriangleMesh &mesh = *draws[draw_id].mesh;
+        const Matrix4x4 &model_matrix = *draws[draw_id].model_matrix;
+        std::vector<Vector3> &vertices = light_space[draw_id];
+        vertices.resize(mesh.vertices.size());
+        parallel_for([&](int64_t v) {
+            Vector3 p = transform_point(model_matrix, mesh.vertices[v]);
+            vertices[v] = Vector3{dot(p, axis_x), dot(p, axis_y), dot(p, axis_z)};
+        }, mesh.vertices.size(), options.num_threads, 4096);
+        for (const Vector3 &v : vertices) {
+            for (int k = 0; k < 3; k++) {
+                box_min[k] = min(box_min[k], v[k]);
+                box_max[k] = max(box_max[k], v[k]);
+            }
+        }
+    }
+
+    if (!(box_min.x <= box_max.x)) {
+        box_min = box_max = Vector3{0, 0, 0}; // no vertices
+    }
+
+    ShadowMap shadow;
+    const int size = (options.shadow_map_size + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE * DEPTH_TILE_SIZE;
+    shadow.depth.assign(int64_t(size) * size, -std::numeric_limits<float>::infinity());
+    shadow.map = DepthMap{shadow.depth.data(), size, size};
+    const Real scale = size / max(max(box_max.x - box_min.x, box_max.y - box_min.y), Real(1e-6));
+    // Light space to the map, with the y-axis flipped as on the screen. The
+    // depth starts at the far end of the box, so that it keeps the relative
+    // precision of a float over the scene wherever the scene is.
+    const Matrix4x4 from_world(axis_x.x * scale, axis_x.y * scale, axis_x.z * scale, -box_min.x * scale,
+                               -axis_y.x * scale, -axis_y.y * scale, -axis_y.z * scale, box_max.y * scale,
+                               axis_z.x, axis_z.y, axis_z.z, -box_min.z,
+                               Real(0), Real(0), Real(0), Real(1));
+    shadow.from_camera = from_world * scene.camera.cam_to_world;
+    // Surfaces at a grazing angle to the light move in depth by many
+    // samples across the footprint of the filter, so points are moved off
+    // them along their normals by about that footprint
+    const int radius = options.shadow_pcf / 2;
+    shadow.normal_offset = (radius + Real(1)) / scale;
+    shadow.bias = Real(1) / scale;
+
+    // Triangle setup, one triangle per face
+    std::vector<int> face_offsets(num_draws + 1, 0);
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        face_offsets[draw_id + 1] = face_offsets[draw_id] + (int)draws[draw_id].mesh->faces.size();
+    }
+    std::vector<ScreenTriangle<float>> triangles(face_offsets.back());
+    std::vector<CullResult> culling(face_offsets.back());
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        const std::vector<Vector3> &vertices = light_space[draw_id];
+        const std::vector<Vector3i> &faces = draws[draw_id].mesh->faces;
+        parallel_for([&](int64_t face_id) {
+            const int id = face_offsets[draw_id] + int(face_id);
+            Vector2 p[3];
+            Real depth[3];
+            for (int i = 0; i < 3; i++) {
+                const Vector3 &v = vertices[faces[face_id][i]];
+                p[i] = Vector2{(v.x - box_min.x) * scale, (box_max.y - v.y) * scale};
+                depth[i] = v.z - box_min.z;
+            }
+            culling[id] = setup_triangle<float>(triangles[id], nullptr, nullptr, p, depth, nullptr, nullptr,
+                                                size, size, false, nullptr);
+        }, faces.size(), options.num_threads, 1024);
+    }
+
+    // Every tile is rasterized by one worker
+    const int num_tiles_x = (size + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+    const int num_tiles = num_tiles_x * num_tiles_x;
+    const std::vector<TileBins> bins =
+        bin_triangles(triangles, culling, nullptr, SHADOW_TILE_SIZE, num_tiles_x, num_tiles, options.num_threads);
+    const DepthKernel kernel = select_depth_kernel(options.simd);
+    std::mutex stats_mutex;
+    parallel_for([&](int64_t tile) {
+        RasterStats tile_stats;
+        const int tile_x0 = int(tile % num_tiles_x) * SHADOW_TILE_SIZE;
+        const int tile_y0 = int(tile / num_tiles_x) * SHADOW_TILE_SIZE;
+        const int tile_x1 = min(tile_x0 + SHADOW_TILE_SIZE, size);
+        const int tile_y1 = min(tile_y0 + SHADOW_TILE_SIZE, size);
+        for (const TileBins &bin : bins) {
+            for (int j = bin.offsets[tile]; j < bin.offsets[tile + 1]; j++) {
+                const ScreenTriangle<float> &tri = triangles[bin.indices[j]];
+                tile_stats.shadow_writes += (tri.exact_in_double ? kernel : rasterize_depth_scalar)(
+                    tri, max(tri.x_min, tile_x0), min(tri.x_max, tile_x1 - 1),
+                    max(tri.y_min, tile_y0), min(tri.y_max, tile_y1 - 1), shadow.map);
+                tile_stats.shadow_triangles++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats += tile_stats;
+    }, num_tiles, options.num_threads);
+    return shadow;
+}
+
+/// The samples of the tile a worker is rasterizing. Workers reuse their
+/// buffer from tile to tile, and every tile is resolved into the output image
+/// as soon as it is done, so no full-screen super-sampled buffer is ever needed.
+template <typename T>
+struct TileBuffer {
+    std::vector<TVector3<T>> color; // per sample, empty with MSAA or when the samples go to a ring
+    std::vector<float> depth; // per sample
+    std::vector<uint32_t> ids; // per sample in visibility-buffer mode
+    std::vector<MsaaPixel<T>> pixels; // per pixel with MSAA
+    LitBatch<T> lit; // fragments queued for lighting by the deferred shading
+    // scratch of the resolve: a block of vertically filtered samples, and the rows it is filtered from
+    std::vector<T> filtered;
+    std::vector<const T *> tap_rows;
+};
+
+/// A reconstruction filter sampled at the samples around a pixel, the same
+/// along both axes. Tap k weighs the sample begin + k from the first sample
+/// of the pixel; the weights sum to one.
+template <typename T>
+struct FilterTaps {
+    int begin;
+    std::vector<T> weights;
+    int reach; // samples read beyond those of the pixel on either side
+
+    /**
+     * Sample a filter at the sample positions of an anti-aliasing factor
+     * @param filter The filter
+     * @param AA_FACTOR The anti-aliasing factor
+     */
+    FilterTaps(ResolveFilter filter, int AA_FACTOR) {
+        Real radius = 0.5; // in pixels
+        switch (filter) {
+            case ResolveFilter::Box: radius = 0.5; break;
+            case ResolveFilter::Tent: radius = 1; break;
+            case ResolveFilter::Mitchell: radius = 2; break;
+            case ResolveFilter::Lanczos: radius = 2; break;
+        }
+        auto weight = [&](Real d) -> Real {
+            d = fabs(d);
+            if (d >= radius) {
+                return 0;
+            }
+            switch (filter) {
+                case ResolveFilter::Box:
+                    return 1;
+                case ResolveFilter::Tent:
+                    return 1 - d;
+                case ResolveFilter::Mitchell: {
+                    const Real B = Real(1) / 3, C = Real(1) / 3;
+                    if (d < 1) {
+                        return ((12 - 9 * B - 6 * C) * d * d * d + (-18 + 12 * B + 6 * C) * d * d + (6 - 2 * B)) / 6;
+                    }
+                    return ((-B - 6 * C) * d * d * d + (6 * B + 30 * C) * d * d +
+                            (-12 * B - 48 * C) * d + (8 * B + 24 * C)) / 6;
+                }
+                case ResolveFilter::Lanczos: {
+                    if (d == 0) {
+                        return 1;
+                    }
+                    Real x = c_PI * d;
+                    return radius * sin(x) * sin(x / radius) / (x * x);
+                }
+            }
+            return 0;
+        };
+        // The samples lie at the centers of their cells, (k + 1/2) / AA_FACTOR
+        // pixels from the left of the pixel. Zero weights at the ends are dropped.
+        const int apron = int(ceil(radius - Real(0.5))) * AA_FACTOR;
+        std::vector<Real> w;
+        Real sum = 0;
+        for (int k = -apron; k < AA_FACTOR + apron; k++) {
+            w.push_back(weight((k + Real(0.5)) / AA_FACTOR - Real(0.5)));
+            sum += w.back();
+        }
+        int first = 0, last = (int)w.size() - 1;
+        while (w[first] == 0) {
+            first++;
+        }
+        while (w[last] == 0) {
+            last--;
+        }
+        begin = first - apron;
+        for (int k = first; k <= last; k++) {
+            weights.push_back(T(w[k] / sum));
+        }
+        reach = max(max(-begin, begin + (int)weights.size() - AA_FACTOR), 0);
+    }
+};
+
+/// Output pixels per block of the resolve. The vertically filtered samples
+/// of a block, 3 * RESOLVE_BLOCK * aa_factor values plus the reach of the
+/// filter, stay in the L1 cache for the horizontal pass.
+constexpr int RESOLVE_BLOCK = 64;
+
+/**
+ * Resolve the pixels [x0, x1) x [y0, y1) from their samples with a separable
+ * filter: a SIMD pass down the tap rows of a block of pixels, then one
+ * across the filtered samples of every pixel.
+ * @param img The output image
+ * @param sample_row Returns the samples of a screen row, from column sx0 on
+ * @param sx0 The first sample column available
+ * @param sy0 The first sample row available
+ * @param sx1 The end of the sample columns available
+ * @param sy1 The end of the sample rows available
+ * @param taps The filter; taps beyond the samples available read the nearest one
+ * @param AA_FACTOR The anti-aliasing factor
+ * @param filter_rows The vertical pass
+ * @param scratch The buffer of the worker, for its resolve scratch
+ */
+template <typename T, typename SampleRow>
+void resolve_region(Image3 &img, const SampleRow &sample_row, int sx0, int sy0, int sx1, int sy1,
+                    const FilterTaps<T> &taps, int AA_FACTOR, FilterRowsKernel<T> filter_rows,
+                    int x0, int y0, int x1, int y1, TileBuffer<T> &scratch) {
+    const int num_taps = (int)taps.weights.size();
+    scratch.tap_rows.resize(2 * num_taps);
+    const T **row_starts = scratch.tap_rows.data(), **rows = row_starts + num_taps;
+    scratch.filtered.resize(3 * (min(RESOLVE_BLOCK, x1 - x0) * AA_FACTOR + num_taps));
+    T *filtered = scratch.filtered.data();
+    for (int y = y0; y < y1; y++) {
+        for (int k = 0; k < num_taps; k++) {
+            int sy = std::clamp(y * AA_FACTOR + taps.begin + k, sy0, sy1 - 1);
+            row_starts[k] = sample_row(sy)->ptr();
+        }
+        for (int bx0 = x0; bx0 < x1; bx0 += RESOLVE_BLOCK) {
+            const int bx1 = min(bx0 + RESOLVE_BLOCK, x1);
+            const int c0 = max(bx0 * AA_FACTOR + taps.begin, sx0);
+            const int c1 = min((bx1 - 1) * AA_FACTOR + taps.begin + num_taps, sx1);
+            for (int k = 0; k < num_taps; k++) {
+                rows[k] = row_starts[k] + 3 * (c0 - sx0);
+            }
+            filter_rows(filtered, rows, taps.weights.data(), num_taps, 3 * (c1 - c0));
+            for (int x = bx0; x < bx1; x++) {
+                const int s0 = x * AA_FACTOR + taps.begin;
+                TVector3<T> sum(T(0), T(0), T(0));
+                for (int k = 0; k < num_taps; k++) {
+                    // only the taps past the border of the screen are clamped
+                    const int column = s0 >= c0 && s0 + num_taps <= c1 ? s0 + k : std::clamp(s0 + k, c0, c1 - 1);
+                    const T *sample = filtered + 3 * (column - c0);
+                    const T w = taps.weights[k];
+                    sum.x = sum.x + w * sample[0];
+                    sum.y = sum.y + w * sample[1];
+                    sum.z = sum.z + w * sample[2];
+                }
+                img(x, y) = Vector3(sum);
+            }
+        }
+    }
+}
+
+/// Triangle slots per cluster of the front-to-back sort. Consecutive faces
+/// of a mesh are usually close together on its surface, so a cluster is a
+/// small patch that is sorted as a whole.
+constexpr int SORT_CLUSTER_SIZE = 64;
+
+/**
+ * Order the visible triangles of a frame roughly front to back, so that the
+ * depth test rejects more of the samples behind them instead of overwriting
+ * their colors later. Meshes are ordered by their nearest visible triangle,
+ * and the clusters within each mesh by theirs. Every instance of a mesh is
+ * ordered on its own. Ties keep the submission order.
+ * @param triangles The triangles of the frame
+ * @param culling What the culling stage decided about each triangle
+ * @param face_offsets The first triangle slot of every face, per draw
+ * @param stats The counters to update
+ * @return The indices of the visible triangles in drawing order
+ */
+template <typename T>
+std::vector<int> front_to_back_order(const std::vector<ScreenTriangle<T>> &triangles,
+                                     const std::vector<CullResult> &culling,
+                                     const std::vector<std::vector<int>> &face_offsets,
+                                     RasterStats &stats) {
+    struct Cluster {
+        T depth; // of the nearest triangle, larger is nearer
+        int begin, end;
+    };
+    auto nearer = [](const auto &a, const auto &b) { return a.depth > b.depth; };
+
+    struct MeshOrder {
+        T depth;
+        std::vector<Cluster> clusters;
+    };
+    std::vector<MeshOrder> meshes;
+    for (const std::vector<int> &offsets : face_offsets) {
+        MeshOrder mesh{-std::numeric_limits<T>::infinity(), {}};
+        for (int begin = offsets.front(); begin < offsets.back(); begin += SORT_CLUSTER_SIZE) {
+            Cluster cluster{-std::numeric_limits<T>::infinity(), begin, min(begin + SORT_CLUSTER_SIZE, offsets.back())};
+            bool visible = false;
+            for (int i = cluster.begin; i < cluster.end; i++) {
+                if (culling[i] == CullResult::Visible) {
+                    cluster.depth = max(cluster.depth, triangles[i].max_depth);
+                    visible = true;
+                }
+            }
+            if (visible) {
+                mesh.depth = max(mesh.depth, cluster.depth);
+                mesh.clusters.push_back(cluster);
+            }
+        }
+        if (!mesh.clusters.empty()) {
+            std::stable_sort(mesh.clusters.begin(), mesh.clusters.end(), nearer);
+            stats.sorted_clusters += mesh.clusters.size();
+            meshes.push_back(std::move(mesh));
+        }
+    }
+    std::stable_sort(meshes.begin(), meshes.end(), nearer);
+
+    std::vector<int> order;
+    for (const MeshOrder &mesh : meshes) {
+        for (const Cluster &cluster : mesh.clusters) {
+            for (int i = cluster.begin; i < cluster.end; i++) {
+                if (culling[i] == CullResult::Visible) {
+                    order.push_back(i);
+                }
+            }
+        }
+    }
+    return order;
+}
+
+/**
+ * The largest difference between the channels of two colors
+ * @param a The first color
+ * @param b The second color
+ * @return The difference
+ */
+inline Real color_difference(const Vector3 &a, const Vector3 &b) {
+    return max(max(fabs(a.x - b.x), fabs(a.y - b.y)), fabs(a.z - b.z));
+}
+
+/**
+ * Snap the sample positions of a pattern to fixed-point offsets from the cell centers
+ * @param anti_aliasing The samples per pixel and their pattern
+ * @param offsets The offsets to fill in
+ * @return False for the grid pattern, which needs no offsets
+ */
+bool setup_sample_offsets(const AntiAliasing &anti_aliasing, SampleOffsets &offsets) {
+    const int n = anti_aliasing.aa_factor;
+    if (n < 1) {
+        Error("The anti-aliasing factor must be at least 1.");
+    }
+    if (anti_aliasing.pattern == SamplePattern::Grid || n == 1) {
+        return false;
+    }
+    if (n > MAX_PATTERN_SIZE || 8 % n != 0) {
+        Error("Sample patterns other than the grid need 2, 4 or 8 samples per pixel axis.");
+    }
+    std::vector<Vector2> positions = sample_positions(anti_aliasing);
+    offsets.size = n;
+    offsets.max_offset = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            // the position within the cell, from its center
+            const Vector2 &p = positions[j * n + i];
+            int c = j * n + i;
+            offsets.dx[c] = std::llround((p.x * n - i) * SUBPIXEL_ONE) - SUBPIXEL_ONE / 2;
+            offsets.dy[c] = std::llround((p.y * n - j) * SUBPIXEL_ONE) - SUBPIXEL_ONE / 2;
+            offsets.fx[c] = float(offsets.dx[c]) / SUBPIXEL_ONE;
+            offsets.fy[c] = float(offsets.dy[c]) / SUBPIXEL_ONE;
+            offsets.max_offset = max(offsets.max_offset, max(std::abs(offsets.dx[c]), std::abs(offsets.dy[c])));
+        }
+    }
+    return true;
+}
+
+/**
+ * Render a scene with depth and colors carried in T
+ * @param scene The scene
+ * @param options The rasterizer settings
+ * @return The rendered image
+ */
+template <typename T>
+Image3 render_impl(const Scene &scene, const RenderOptions &options) {
+    const int width = scene.camera.resolution.x;
+    const int height = scene.camera.resolution.y;
+    Image3 img(width, height);
+
+    // Anti-aliasing of the camera, unless overridden by the options
+    AntiAliasing anti_aliasing = scene.camera.anti_aliasing;
+    if (options.aa_factor > 0) {
+        anti_aliasing.aa_factor = options.aa_factor;
+    }
+    if (options.sample_pattern) {
+        anti_aliasing.pattern = *options.sample_pattern;
+    }
+    const int AA_FACTOR = anti_aliasing.aa_factor;
+    const int SUPER_WIDTH = width * AA_FACTOR;
+    const int SUPER_HEIGHT = height * AA_FACTOR;
+    SampleOffsets pattern_offsets;
+    const SampleOffsets *pattern = setup_sample_offsets(anti_aliasing, pattern_offsets) ? &pattern_offsets : nullptr;
+
+    if (options.msaa && AA_FACTOR > 8) {
+        Error("MSAA supports at most 8x8 samples per pixel.");
+    }
+    // Textures and lights are applied only where they are seen: the kernels
+    // interpolate the texture coordinates and normals into the visibility
+    // buffer, and the deferred shading looks the texture up and lights the
+    // fragments once per visible sample
+    bool textured = false;
+    for (const TriangleMesh &mesh : scene.meshes) {
+        textured = textured || (mesh.texture >= 0 && !options.use_face_colors);
+    }
+    const bool lit = !scene.lights.empty() && !options.use_face_colors;
+    const bool visibility_buffer = options.visibility_buffer || textured || lit;
+    if (options.msaa && options.visibility_buffer) {
+        Error("The visibility buffer is per sample and cannot be combined with MSAA.");
+    }
+    if (options.msaa && (textured || lit)) {
+        Error("Textures and lights are shaded through the visibility buffer and cannot be combined with MSAA.");
+    }
+    if (options.msaa && options.adaptive_aa) {
+        Error("Edge-adaptive anti-aliasing cannot be combined with MSAA.");
+    }
+    const bool adaptive = options.adaptive_aa && AA_FACTOR > 1;
+    const FilterTaps<T> taps(options.filter, AA_FACTOR);
+    const FilterRowsKernel<T> filter_rows = select_filter_rows<T>(options.simd);
+    if (taps.reach > 0 && (options.msaa || adaptive)) {
+        Error("Filters wider than a pixel need every sample, so they cannot be combined with MSAA or "
+              "edge-adaptive anti-aliasing.");
+    }
+
+    // Vertex processing and culling. Every face gets one slot for its
+    // triangle, or room for the whole fan if it has to be clipped.
+    const Real aspect_ratio = static_cast<float>(width) / height;
+    // The guard band reaches about MAX_SCREEN_COORD / 2 past the screen on every side
+    const Frustum frustum(aspect_ratio, scene.camera.s, scene.camera.z_near, scene.camera.z_far,
+                          MAX_SCREEN_COORD / max(SUPER_WIDTH, SUPER_HEIGHT));
+    Matrix4x4 view = inverse(scene.camera.cam_to_world);
+    const std::vector<MeshDraw> draws = mesh_draws(scene);
+    const int num_draws = (int)draws.size();
+    std::vector<ProcessedVertices> processed(num_draws);
+    std::vector<uint8_t> mesh_culled(num_draws);
+    std::vector<std::vector<int>> face_offsets(num_draws);
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        const TriangleMesh &mesh = *draws[draw_id].mesh;
+        Matrix4x4 model_view = view * *draws[draw_id].model_matrix;
+        face_offsets[draw_id].resize(mesh.faces.size() + 1);
+        if (mesh.bound_radius >= 0) {
+            // The radius grows by at most the longest axis of the transform
+            Real scale = 0;
+            for (int j = 0; j < 3; j++) {
+                scale = max(scale, length(Vector3{model_view(0, j), model_view(1, j), model_view(2, j)}));
+            }
+            Vector3 center = transform_point(model_view, mesh.bound_center);
+            mesh_culled[draw_id] = frustum.outside(center, mesh.bound_radius * scale);
+        }
+        if (mesh_culled[draw_id]) {
+            std::fill(face_offsets[draw_id].begin() + 1, face_offsets[draw_id].end(), 1);
+            continue;
+        }
+        ProcessedVertices &vertices = processed[draw_id];
+        transform_vertices(mesh.vertices, model_view, frustum, SUPER_WIDTH, SUPER_HEIGHT, scene.camera.s,
+                           vertices, options.num_threads);
+        if (lit) {
+            // Normals go through the inverse transpose of the model-view matrix, as in hw_3_4.vs
+            Matrix3x3 inv_model_view = inverse(Matrix3x3{
+                model_view(0, 0), model_view(0, 1), model_view(0, 2),
+                model_view(1, 0), model_view(1, 1), model_view(1, 2),
+                model_view(2, 0), model_view(2, 1), model_view(2, 2)});
+            vertices.normals.resize(mesh.vertices.size());
+            parallel_for([&](int64_t v) {
+                const Vector3 &n = mesh.vertex_normals[v];
+                vertices.normals[v] = Vector3{
+                    inv_model_view(0, 0) * n.x + inv_model_view(1, 0) * n.y + inv_model_view(2, 0) * n.z,
+                    inv_model_view(0, 1) * n.x + inv_model_view(1, 1) * n.y + inv_model_view(2, 1) * n.z,
+                    inv_model_view(0, 2) * n.x + inv_model_view(1, 2) * n.y + inv_model_view(2, 2) * n.z};
+            }, mesh.vertices.size(), options.num_threads, 4096);
+        }
+        parallel_for([&](int64_t face_id) {
+            const Vector3i &face = mesh.faces[face_id];
+            int or_code = vertices.outcodes[face[0]] | vertices.outcodes[face[1]] | vertices.outcodes[face[2]];
+            face_offsets[draw_id][face_id + 1] = or_code & (CLIP_NEAR | CLIP_FAR | CLIP_GUARD) ?
+                MAX_CLIP_VERTICES - 2 : 1;
+        }, mesh.faces.size(), options.num_threads, 1024);
+    }
+    // Turn the slot counts into offsets
+    RasterStats stats;
+    int num_triangles = 0;
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        std::vector<int> &offsets = face_offsets[draw_id];
+        offsets[0] = num_triangles;
+        for (int f = 1; f < (int)offsets.size(); f++) {
+            stats.clipped += offsets[f] > 1;
+            offsets[f] += offsets[f - 1];
+        }
+        num_triangles = offsets.back();
+    }
+
+    // Clipping and triangle setup
+    std::vector<ScreenTriangle<T>> triangles(num_triangles);
+    std::vector<AttributePlane<T>> attribute_planes(
+        options.use_face_colors ? 0 : int64_t(num_triangles) * NUM_COLOR_ATTRIBUTES);
+    std::vector<AttributePlane<T>> normal_planes(lit ? int64_t(num_triangles) * 3 : 0);
+    std::vector<CullResult> culling(num_triangles);
+    for (int draw_id = 0; draw_id < num_draws; draw_id++) {
+        const TriangleMesh &mesh = *draws[draw_id].mesh;
+        const Vector3 *instance_color = draws[draw_id].color;
+        const std::vector<int> &offsets = face_offsets[draw_id];
+        if (mesh_culled[draw_id]) {
+            std::fill(culling.begin() + offsets.front(), culling.begin() + offsets.back(), CullResult::Frustum);
+            continue;
+        }
+        const ProcessedVertices &vertices = processed[draw_id];
+        // A textured mesh interpolates (u, v, 0) in place of its vertex colors,
+        // and an instance with a color of its own interpolates that color
+        const Texture *texture =
+            !options.use_face_colors && mesh.texture >= 0 ? &scene.textures[mesh.texture] : nullptr;
+        auto vertex_color = [&](int v) {
+            return texture ? Vector3{mesh.uvs[v].x, mesh.uvs[v].y, Real(0)} :
+                instance_color ? *instance_color : mesh.vertex_colors[v];
+        };
+        auto face_color = [&](int face_id) {
+            return instance_color ? *instance_color : mesh.face_colors[face_id];
+        };
+        parallel_for([&](int64_t face_id) {
+            const Vector3i &face = mesh.faces[face_id];
+            const int tri_id = offsets[face_id];
+            for (int id = tri_id; id < offsets[face_id + 1]; id++) {
+                triangles[id].id = uint32_t(id);
+                triangles[id].texture = texture;
+                triangles[id].shininess = float(mesh.shininess);
+            }
+            const int and_code = vertices.outcodes[face[0]] & vertices.outcodes[face[1]] & vertices.outcodes[face[2]];
+            if (and_code & (CLIP_NEAR | CLIP_FAR | CLIP_SIDES)) {
+                // all three vertices lie outside the same plane
+                std::fill(culling.begin() + tri_id, culling.begin() + offsets[face_id + 1], CullResult::Frustum);
+                return;
+            }
+            auto planes_of = [&](int id) {
+                return options.use_face_colors ? nullptr : &attribute_planes[int64_t(id) * NUM_COLOR_ATTRIBUTES];
+            };
+            auto normal_planes_of = [&](int id) {
+                return lit ? &normal_planes[int64_t(id) * 3] : nullptr;
+            };
+            if (options.use_face_colors) {
+                for (int id = tri_id; id < offsets[face_id + 1]; id++) {
+                    triangles[id].color = TVector3<T>(face_color(face_id));
+                }
+            }
+            if (offsets[face_id + 1] - tri_id == 1) {
+                Vector2 p[3];
+                Real inv_w[3];
+                Vector3 colors[3], normals[3];
+                for (int i = 0; i < 3; i++) {
+                    p[i] = Vector2{vertices.screen_x[face[i]], vertices.screen_y[face[i]]};
+                    inv_w[i] = -1 / vertices.camera[face[i]].z;
+                    if (!options.use_face_colors) {
+                        colors[i] = vertex_color(face[i]);
+                    }
+                    if (lit) {
+                        normals[i] = vertices.normals[face[i]];
+                    }
+                }
+                culling[tri_id] = setup_triangle(triangles[tri_id], planes_of(tri_id), normal_planes_of(tri_id),
+                                                 p, inv_w, options.use_face_colors ? nullptr : colors,
+                                                 lit ? normals : nullptr,
+                                                 SUPER_WIDTH, SUPER_HEIGHT, mesh.cull_backface, pattern);
+                return;
+            }
+
+            // Clip, then set up the fan of triangles around the first vertex left
+            ClipVertex poly[MAX_CLIP_VERTICES];
+            const int or_code = vertices.outcodes[face[0]] | vertices.outcodes[face[1]] | vertices.outcodes[face[2]];
+            for (int i = 0; i < 3; i++) {
+                poly[i].position = vertices.camera[face[i]];
+                poly[i].color = options.use_face_colors ? face_color(face_id) : vertex_color(face[i]);
+                poly[i].normal = lit ? vertices.normals[face[i]] : Vector3{0, 0, 0};
+            }
+            int count = clip_polygon(poly, 3, frustum, or_code & (CLIP_NEAR | CLIP_FAR | CLIP_GUARD));
+            for (int k = 0; k < MAX_CLIP_VERTICES - 2; k++) {
+                if (k + 2 >= count) {
+                    culling[tri_id + k] = k == 0 ? CullResult::Frustum : CullResult::Empty;
+                    continue;
+                }
+                const ClipVertex *corners[3] = {&poly[0], &poly[k + 1], &poly[k + 2]};
+                Vector2 p[3];
+                Real inv_w[3];
+                Vector3 colors[3], normals[3];
+                for (int i = 0; i < 3; i++) {
+                    p[i] = toScreenSpace(project(corners[i]->position), SUPER_WIDTH, SUPER_HEIGHT, scene.camera.s);
+                    inv_w[i] = -1 / corners[i]->position.z;
+                    colors[i] = corners[i]->color;
+                    normals[i] = corners[i]->normal;
+                }
+                culling[tri_id + k] = setup_triangle(triangles[tri_id + k], planes_of(tri_id + k),
+                                                     normal_planes_of(tri_id + k), p, inv_w,
+                                                     options.use_face_colors ? nullptr : colors,
+                                                     lit ? normals : nullptr,
+                                                     SUPER_WIDTH, SUPER_HEIGHT, mesh.cull_backface, pattern);
+            }
+        }, mesh.faces.size(), options.num_threads, 1024);
+    }
+    for (CullResult result : culling) {
+        switch (result) {
+            case CullResult::Visible: break;
+            case CullResult::Frustum: stats.culled_frustum++; break;
+            case CullResult::BackFace: stats.culled_backface++; break;
+            case CullResult::NoCoverage: stats.culled_no_coverage++; break;
+            case CullResult::Degenerate: stats.culled_degenerate++; break;
+            case CullResult::Empty: break;
+        }
+    }
+
+    // Drawing order: the submission order, or front to back if asked for
+    std::vector<int> draw_order;
+    if (options.sort_front_to_back) {
+        draw_order = front_to_back_order(triangles, culling, face_offsets, stats);
+    }
+
+    // Binning: every triangle is appended to the tiles its bounding box overlaps.
+    const int TILE_SIZE = options.tile_size * AA_FACTOR; // in super-samples
+    const int num_tiles_x = (SUPER_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    const int num_tiles_y = (SUPER_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    const int num_tiles = num_tiles_x * num_tiles_y;
+    const int num_threads = options.num_threads > 0 ? options.num_threads : num_system_cores();
+    const std::vector<TileBins> bins = bin_triangles(triangles, culling,
+                                                     options.sort_front_to_back ? &draw_order : nullptr,
+                                                     TILE_SIZE, num_tiles_x, num_tiles, options.num_threads);
+
+    // Rasterization: every tile is cleared, rasterized and resolved by one worker,
+    // in a tile-sized buffer of that worker.
+    // Blocks never straddle tiles, so each tile owns the Hi-Z entries over it.
+    // They cover whole pixels, so a pixel is either cleared lazily with its
+    // block or not at all, and with MSAA it is shaded once per triangle.
+    int BLOCK_SIZE = options.block_size > 0 ? min(options.block_size, TILE_SIZE) : TILE_SIZE;
+    BLOCK_SIZE = (BLOCK_SIZE + AA_FACTOR - 1) / AA_FACTOR * AA_FACTOR;
+    // The kernels are specialized at compile time for every combination of
+    // features; the ones fixed over the frame are picked here
+    const RasterKernelTable<T> &kernels =
+        options.msaa ? rasterize_triangle_msaa_kernels<T>(AA_FACTOR) : select_kernels<T>(options.simd);
+    const int frame_features = (options.use_face_colors ? KERNEL_FLAT : 0) |
+                               (visibility_buffer ? KERNEL_VISIBILITY : 0) |
+                               (pattern ? KERNEL_PATTERN : 0);
+    if (taps.reach > TILE_SIZE) {
+        Error("The tiles are too small for the reach of the filter.");
+    }
+    // The shading of the visibility buffer. Lights are directions in world
+    // space, as lightPos in hw_3_4.fs, and turned to camera space here.
+    DeferredShading shading{options.use_face_colors, pattern, options.texture_filter, {},
+                            select_shade_lights(options.simd),
+                            2 * aspect_ratio * scene.camera.s / SUPER_WIDTH, -aspect_ratio * scene.camera.s,
+                            -2 * scene.camera.s / SUPER_HEIGHT, scene.camera.s};
+    if (lit) {
+        for (const Light &light : scene.lights) {
+            Vector3 direction = normalize(Vector3{
+                view(0, 0) * light.position.x + view(0, 1) * light.position.y + view(0, 2) * light.position.z,
+                view(1, 0) * light.position.x + view(1, 1) * light.position.y + view(1, 2) * light.position.z,
+                view(2, 0) * light.position.x + view(2, 1) * light.position.y + view(2, 2) * light.position.z});
+            shading.lights.push_back(ShadingLight{
+                {float(direction.x), float(direction.y), float(direction.z)},
+                {float(light.color.x), float(light.color.y), float(light.color.z)}});
+            if (options.shadow_map_size > 0) {
+                shading.shadows.push_back(render_shadow_map(scene, normalize(light.position), options, stats));
+            }
+        }
+        shading.pcf_radius = options.shadow_pcf / 2;
+        shading.aa_factor = AA_FACTOR;
+    }
+    // Filters wider than a pixel read the samples of the neighbouring tiles.
+    // Tiles then draw their colors straight into a ring of three rows of
+    // tiles, a row of tiles at a time, and the pixels of a row are resolved
+    // once the rows around it are drawn.
+    std::vector<TVector3<T>> ring;
+    if (taps.reach > 0) {
+        ring.resize(int64_t(3) * TILE_SIZE * SUPER_WIDTH);
+    }
+    auto ring_row = [&](int sy) {
+        return ring.data() + (int64_t(sy / TILE_SIZE % 3) * TILE_SIZE + sy % TILE_SIZE) * SUPER_WIDTH;
+    };
+    // Depth is kept per sample. Color is kept per sample too, or
+    // with MSAA as a few colors per pixel with their sample masks.
+    std::vector<TileBuffer<T>> buffers(num_threads);
+    for (TileBuffer<T> &buffer : buffers) {
+        buffer.depth.resize(TILE_SIZE * TILE_SIZE);
+        if (options.msaa) {
+            buffer.pixels.resize(options.tile_size * options.tile_size);
+        } else if (taps.reach == 0) {
+            buffer.color.resize(TILE_SIZE * TILE_SIZE);
+        }
+        if (visibility_buffer || adaptive) {
+            buffer.ids.resize(TILE_SIZE * TILE_SIZE);
+        }
+        if (!shading.shadows.empty()) {
+            buffer.lit.shadow.resize(shading.shadows.size() * LitBatch<T>::CAPACITY);
+            buffer.lit.cached_pixel.resize(SHADOW_CACHE_SIZE * SHADOW_CACHE_SIZE);
+            buffer.lit.cached_triangle.resize(SHADOW_CACHE_SIZE * SHADOW_CACHE_SIZE);
+            buffer.lit.cached_visibility.resize(SHADOW_CACHE_SIZE * SHADOW_CACHE_SIZE * shading.shadows.size());
+        }
+    }
+    std::mutex stats_mutex;
+
+    // Edge-adaptive anti-aliasing: a first pass rasterizes and shades one
+    // sample per pixel straight into the image. Pixels next to a pixel of a
+    // different triangle, and colored differently from it by more than the
+    // tolerance, lie on an edge or a depth discontinuity. Only the blocks
+    // holding them are rasterized at the full sample rate below, and only they
+    // are resolved from it.
+    std::vector<uint8_t> refine;
+    if (adaptive) {
+        std::vector<uint32_t> pixel_ids(int64_t(width) * height);
+        parallel_for([&](int64_t tile, int worker) {
+            RasterStats tile_stats;
+            const int px0 = int(tile % num_tiles_x) * options.tile_size;
+            const int py0 = int(tile / num_tiles_x) * options.tile_size;
+            const int px1 = min(px0 + options.tile_size, width);
+            const int py1 = min(py0 + options.tile_size, height);
+            const int tile_width = px1 - px0;
+
+            TileBuffer<T> &buffer = buffers[worker];
+            const RasterTarget<T> target{nullptr, buffer.depth.data(), buffer.ids.data(), tile_width, 0,
+                                      nullptr, 0, AA_FACTOR, px0, py0, pattern, TVector3<T>(scene.background)};
+            std::fill_n(buffer.depth.begin(), tile_width * (py1 - py0), -std::numeric_limits<float>::infinity());
+            std::fill_n(buffer.ids.begin(), tile_width * (py1 - py0), NO_TRIANGLE);
+            std::fill(buffer.lit.cached_pixel.begin(), buffer.lit.cached_pixel.end(), -1);
+            for (const TileBins &bin : bins) {
+                for (int j = bin.offsets[tile]; j < bin.offsets[tile + 1]; j++) {
+                    rasterize_triangle_pixels(triangles[bin.indices[j]], target, px1, py1);
+                }
+            }
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1; x++) {
+                    int index = (y - py0) * tile_width + (x - px0);
+                    uint32_t id = buffer.ids[index];
+                    pixel_ids[int64_t(y) * width + x] = id;
+                    if (id == NO_TRIANGLE) {
+                        img(x, y) = scene.background;
+                    } else {
+                        const int offset = AA_FACTOR / 2;
+                        shade_deferred(triangles[id], x * AA_FACTOR + offset, y * AA_FACTOR + offset, shading,
+                                       buffer.lit, &buffer.color[index]);
+                        tile_stats.shaded++;
+                    }
+                }
+            }
+            flush_lit_batch(buffer.lit, shading);
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1; x++) {
+                    int index = (y - py0) * tile_width + (x - px0);
+                    if (buffer.ids[index] != NO_TRIANGLE) {
+                        img(x, y) = Vector3(buffer.color[index]);
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats += tile_stats;
+        }, num_tiles, num_threads);
+
+        refine.resize(int64_t(width) * height);
+        parallel_for([&](int64_t y) {
+            for (int x = 0; x < width; x++) {
+                uint32_t id = pixel_ids[y * width + x];
+                for (int ny = max(int(y) - 1, 0); ny <= min(int(y) + 1, height - 1) && !refine[y * width + x]; ny++) {
+                    for (int nx = max(x - 1, 0); nx <= min(x + 1, width - 1); nx++) {
+                        if (pixel_ids[int64_t(ny) * width + nx] != id &&
+                                color_difference(img(nx, ny), img(x, int(y))) > options.adaptive_tolerance) {
+                            refine[y * width + x] = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        }, height, options.num_threads, 16);
+        for (uint8_t r : refine) {
+            stats.refined_pixels += r;
+        }
+    }
+
+    auto draw_tile = [&](int64_t tile, int worker) {
+        RasterStats tile_stats;
+        const int tile_x0 = int(tile % num_tiles_x) * TILE_SIZE;
+        const int tile_y0 = int(tile / num_tiles_x) * TILE_SIZE;
+        const int tile_x1 = min(tile_x0 + TILE_SIZE, SUPER_WIDTH);
+        const int tile_y1 = min(tile_y0 + TILE_SIZE, SUPER_HEIGHT);
+        const int tile_width = tile_x1 - tile_x0;
+
+        const int px0 = tile_x0 / AA_FACTOR, py0 = tile_y0 / AA_FACTOR;
+        const int px1 = tile_x1 / AA_FACTOR, py1 = tile_y1 / AA_FACTOR;
+
+        // With adaptive anti-aliasing only the blocks over pixels to refine are drawn
+        HiZTile<T> hiz(tile_x0, tile_y0, tile_x1, tile_y1, BLOCK_SIZE);
+        if (adaptive) {
+            hiz.block_skipped.assign(hiz.block_far.size(), 1);
+            bool any = false;
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1; x++) {
+                    if (!refine[int64_t(y) * width + x]) {
+                        continue;
+                    }
+                    any = true;
+                    int sx = x * AA_FACTOR - tile_x0, sy = y * AA_FACTOR - tile_y0;
+                    for (int by = sy / BLOCK_SIZE; by <= (sy + AA_FACTOR - 1) / BLOCK_SIZE; by++) {
+                        for (int bx = sx / BLOCK_SIZE; bx <= (sx + AA_FACTOR - 1) / BLOCK_SIZE; bx++) {
+                            hiz.block_skipped[by * hiz.blocks_x + bx] = 0;
+                        }
+                    }
+                }
+            }
+            if (!any) {
+                return;
+            }
+        }
+
+        // The colors of the tile go to the ring for wide filters, and to the tile buffer otherwise
+        TileBuffer<T> &buffer = buffers[worker];
+        TVector3<T> *color = taps.reach > 0 ? ring_row(tile_y0) + tile_x0 : buffer.color.data();
+        const int color_width = taps.reach > 0 ? SUPER_WIDTH : tile_width;
+        // The buffers are cleared by rasterize_triangle_blocks, a block at a time on its first write
+        const RasterTarget<T> target{options.msaa ? nullptr : color, buffer.depth.data(),
+                                  visibility_buffer ? buffer.ids.data() : nullptr, tile_width, color_width,
+                                  buffer.pixels.data(), tile_width / AA_FACTOR, AA_FACTOR,
+                                  tile_x0, tile_y0, pattern, TVector3<T>(scene.background)};
+
+        for (const TileBins &bin : bins) {
+            for (int j = bin.offsets[tile]; j < bin.offsets[tile + 1]; j++) {
+                const ScreenTriangle<T> &tri = triangles[bin.indices[j]];
+                int x_min = max(tri.x_min, tile_x0);
+                int x_max = min(tri.x_max, tile_x1 - 1);
+                int y_min = max(tri.y_min, tile_y0);
+                int y_max = min(tri.y_max, tile_y1 - 1);
+
+                rasterize_triangle_blocks(tri, x_min, x_max, y_min, y_max, hiz, options.occlusion_culling,
+                                          tri.exact_in_double || options.msaa ? kernels :
+                                              rasterize_triangle_scalar_kernels<T>(),
+                                          frame_features, target, tile_stats);
+            }
+        }
+
+        // Deferred shading of the samples left visible, each one exactly once
+        if (visibility_buffer) {
+            tile_stats.visible = shade_visibility_buffer(triangles, target, hiz, shading, buffer.lit);
+            tile_stats.shaded += tile_stats.visible;
+        }
+        if (options.print_stats) {
+            const bool count_visible = !visibility_buffer && !options.msaa;
+            for (int y = tile_y0; y < tile_y1; y++) {
+                for (int x = tile_x0; x < tile_x1; x++) {
+                    if (hiz.block_clear[block_at(hiz, x, y)]) {
+                        continue;
+                    }
+                    float depth = buffer.depth[(y - tile_y0) * tile_width + (x - tile_x0)];
+                    if (depth > -std::numeric_limits<float>::infinity()) {
+                        tile_stats.visible += count_visible;
+                        tile_stats.depth_min = min(tile_stats.depth_min, depth);
+                        tile_stats.depth_max = max(tile_stats.depth_max, depth);
+                    }
+                }
+            }
+        }
+
+        // Resolve the tile straight into the output image, unless its samples are left in the ring.
+        // Pixels of blocks never written are the background.
+        auto sample_row = [&](int sy) { return buffer.color.data() + int64_t(sy - tile_y0) * tile_width; };
+        auto pixel_clear = [&](int x, int y) { return hiz.block_clear[block_at(hiz, x * AA_FACTOR, y * AA_FACTOR)]; };
+        if (adaptive) {
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1; x++) {
+                    if (!refine[int64_t(y) * width + x]) {
+                        continue;
+                    } else if (pixel_clear(x, y)) {
+                        img(x, y) = scene.background;
+                    } else {
+                        resolve_region(img, sample_row, tile_x0, tile_y0, tile_x1, tile_y1, taps, AA_FACTOR,
+                                       filter_rows, x, y, x + 1, y + 1, buffer);
+                    }
+                }
+            }
+        } else if (options.msaa) {
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1; x++) {
+                    if (pixel_clear(x, y)) {
+                        img(x, y) = scene.background;
+                        continue;
+                    }
+                    const MsaaPixel<T> &pixel = buffer.pixels[(y - py0) * target.pixel_width + (x - px0)];
+                    Vector3 sumColor = Vector3{0, 0, 0};
+                    for (int s = 0; s < MSAA_SLOTS; s++) {
+                        sumColor += Real(count_samples(pixel.mask[s])) * Vector3(pixel.color[s]);
+                    }
+                    img(x, y) = sumColor / Real(AA_FACTOR * AA_FACTOR);
+                }
+            }
+        } else if (taps.reach == 0) {
+            // runs of written pixels along each row
+            for (int y = py0; y < py1; y++) {
+                for (int x = px0; x < px1;) {
+                    int end = x;
+                    while (end < px1 && !pixel_clear(end, y)) {
+                        end++;
+                    }
+                    if (end > x) {
+                        resolve_region(img, sample_row, tile_x0, tile_y0, tile_x1, tile_y1, taps, AA_FACTOR,
+                                       filter_rows, x, y, end, y + 1, buffer);
+                        x = end;
+                    } else {
+                        img(x++, y) = scene.background;
+                    }
+                }
+            }
+        } else {
+            // The neighbouring tiles read the samples in the ring, so clear the rest of them
+            for (int block = 0; block < (int)hiz.block_clear.size(); block++) {
+                if (hiz.block_clear[block]) {
+                    clear_block(hiz, block, target);
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats += tile_stats;
+    };
+    if (taps.reach == 0) {
+        parallel_for(draw_tile, num_tiles, num_threads);
+    } else {
+        for (int row = 0; row <= num_tiles_y; row++) {
+            if (row < num_tiles_y) {
+                parallel_for([&](int64_t tile_x, int worker) {
+                    draw_tile(int64_t(row) * num_tiles_x + tile_x, worker);
+                }, num_tiles_x, num_threads);
+            }
+            if (row == 0) {
+                continue;
+            }
+            // The pixels of the previous row of tiles, in columns of blocks,
+            // so the samples shared by the rows of a column stay in cache
+            const int y0 = (row - 1) * options.tile_size, y1 = min(row * options.tile_size, height);
+            parallel_for([&](int64_t block, int worker) {
+                const int x0 = int(block) * RESOLVE_BLOCK;
+                resolve_region(img, ring_row, 0, max(y0 * AA_FACTOR - TILE_SIZE, 0),
+                               SUPER_WIDTH, min(y1 * AA_FACTOR + TILE_SIZE, SUPER_HEIGHT), taps, AA_FACTOR,
+                               filter_rows, x0, y0, min(x0 + RESOLVE_BLOCK, width), y1, buffers[worker]);
+            }, (width + RESOLVE_BLOCK - 1) / RESOLVE_BLOCK, num_threads);
+        }
+    }
+
+    if (options.print_stats) {
+        std::cout << stats << std::endl;
+    }
+
+    return img;
+}
+
+} // namespace
+
+std::ostream& operator<<(std::ostream &os, const RasterStats &stats) {
+    os << "RasterStats[" << std::endl;
+    os << "\tculled_frustum=" << stats.culled_frustum << std::endl;
+    os << "\tculled_backface=" << stats.culled_backface << std::endl;
+    os << "\tculled_no_coverage=" << stats.culled_no_coverage << std::endl;
+    os << "\tculled_degenerate=" << stats.culled_degenerate << std::endl;
+    os << "\tclipped=" << stats.clipped << std::endl;
+    os << "\trefined_pixels=" << stats.refined_pixels << std::endl;
+    os << "\tsorted_clusters=" << stats.sorted_clusters << std::endl;
+    os << "\ttriangles=" << stats.triangles << std::endl;
+    os << "\tblocks_rejected=" << stats.blocks_rejected << std::endl;
+    os << "\tblocks_accepted=" << stats.blocks_accepted << std::endl;
+    os << "\tblocks_partial=" << stats.blocks_partial << std::endl;
+    os << "\ttriangles_occluded=" << stats.triangles_occluded << std::endl;
+    os << "\tblocks_occluded=" << stats.blocks_occluded << std::endl;
+    os << "\tedge_tests=" << stats.edge_tests << std::endl;
+    os << "\tblocks_cleared=" << stats.blocks_cleared << std::endl;
+    os << "\tshaded=" << stats.shaded << std::endl;
+    os << "\tvisibility_writes=" << stats.visibility_writes << std::endl;
+    os << "\tvisible=" << stats.visible << std::endl;
+    if (stats.shadow_triangles > 0) {
+        os << "\tshadow_triangles=" << stats.shadow_triangles << std::endl;
+        os << "\tshadow_writes=" << stats.shadow_writes << std::endl;
+    }
+    if (stats.visible > 0) {
+        // Depth-test passes per visible sample, each of which forward shading colors
+        int64_t writes = stats.visibility_writes > 0 ? stats.visibility_writes : stats.shaded;
+        os << "\toverdraw=" << Real(writes) / Real(stats.visible) << std::endl;
+    }
+    if (stats.depth_min <= stats.depth_max) {
+        // The depth is 1/w, so the view distances are its reciprocals
+        os << "\tdepth_range=[" << stats.depth_min << ", " << stats.depth_max << "] (distance " <<
+              1 / stats.depth_max << " to " << 1 / stats.depth_min << ")" << std::endl;
+    }
+    os << "]";
+    return os;
+}
+
+Image3 render(const Scene &scene, const RenderOptions &options) {
+    if (options.compare_precision) {
+        // Render with both precisions and report the largest difference of a color channel,
+        // then return the image of the precision asked for
+        Image3 img_double = render_impl<double>(scene, options);
+        Image3 img_float = render_impl<float>(scene, options);
+        Real max_diff = 0;
+        int max_x = 0, max_y = 0;
+        for (int y = 0; y < img_double.height; y++) {
+            for (int x = 0; x < img_double.width; x++) {
+                Vector3 diff = img_float(x, y) - img_double(x, y);
+                Real d = max(max(std::abs(diff.x), std::abs(diff.y)), std::abs(diff.z));
+                if (d > max_diff) {
+                    max_diff = d;
+                    max_x = x;
+                    max_y = y;
+                }
+            }
+        }
+        std::cout << "Precision: max |float - double| = " << max_diff <<
+                     " at pixel (" << max_x << ", " << max_y << ")" << std::endl;
+        return options.precision == Precision::Float ? img_float : img_double;
+    }
+    if (options.precision == Precision::Float) {
+        return render_impl<float>(scene, options);
+    }
+    return render_impl<double>(scene, options);
+}
+
+} // namespace hw2
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "hw2_scenes.h"
+#include "image.h"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace hw2 {
+
+/// Instruction set used by the pixel kernel.
+/// Modes the CPU does not support fall back to the next lower one.
+enum class SimdMode {
+    Scalar, // one sample at a time
+    SSE, // 8 samples at a time on SSE2
+    AVX2 // 8 samples at a time on AVX2
+};
+
+/// Scalar type of the color buffers and of the interpolation.
+/// Float halves the memory traffic of the tile buffers and fits twice the
+/// lanes in a SIMD register; the output image is double either way.
+/// The depth buffer is single precision with both: it holds 1/w, which is
+/// reversed-Z with the far plane at infinity, so the float exponent keeps
+/// the relative precision the same at every distance.
+enum class Precision {
+    Double,
+    Float
+};
+
+/// Reconstruction filter of the resolve from the samples to the output pixels.
+/// Filters wider than a pixel also weigh the samples of the neighbouring pixels.
+enum class ResolveFilter {
+    Box, // the mean of the samples of the pixel
+    Tent, // linear falloff over one pixel
+    Mitchell, // Mitchell-Netravali with B = C = 1/3, over two pixels
+    Lanczos // Lanczos-windowed sinc with a = 2, over two pixels
+};
+
+/// Knobs of the tile-based software rasterizer used by the hw2 renderers.
+struct RenderOptions {
+    int aa_factor = 0; // super-sampling factor per axis, 0 = the one of the camera
+    std::optional<SamplePattern> sample_pattern; // the one of the camera if unset
+    bool adaptive_aa = false; // take one sample per pixel, and super-sample only the pixels on edges
+    Real adaptive_tolerance = Real(1) / 256; // color difference across an edge below which it is not super-sampled
+    int num_threads = 0; // worker threads, 0 = all cores
+    int tile_size = 16; // edge length of a screen tile in output pixels
+    int block_size = 8; // edge length in samples of the blocks tested before the samples, 0 = whole tiles
+    bool use_face_colors = false; // flat colors from TriangleMesh::face_colors (HW 2.2)
+    bool occlusion_culling = false; // skip triangles and blocks hidden behind the Hi-Z buffer (HW 2.2 bonus)
+    SimdMode simd = SimdMode::AVX2;
+    bool msaa = false; // keep coverage and depth per sample but shade once per pixel and triangle
+    bool sort_front_to_back = false; // draw meshes and triangle clusters nearest first, so fewer colors are overwritten
+    bool visibility_buffer = false; // rasterize depth and triangle ids only, then shade each visible sample once
+    bool print_stats = false; // print the work counters of the rasterizer
+    Precision precision = Precision::Double;
+    bool compare_precision = false; // render with both precisions and print the largest difference of a pixel
+    ResolveFilter filter = ResolveFilter::Box;
+    TextureFilter texture_filter = TextureFilter::Trilinear; // of the meshes with a texture
+    int shadow_map_size = 0; // edge length in samples of the shadow map of every light, 0 = no shadows
+    int shadow_pcf = 3; // width in samples of the percentage-closer filter of the shadow maps, rounded up to odd
+};
+
+/// Parse the rasterizer flags (-aa, -sample_pattern, -threads, -tile_size,
+/// -block_size, -simd, -precision, -compare_precision, -msaa, -adaptive_aa, -adaptive_tolerance,
+/// -sort, -visibility_buffer, -occlusion_culling, -stats, -filter, -texture_filter,
+/// -shadow_map, -shadow_pcf)
+/// out of a parameter list.
+/// Unknown parameters are ignored, so the homework flags can share the list.
+RenderOptions parse_render_options(const std::vector<std::string> &params);
+
+/// Render a scene with the tile-binned rasterizer.
+/// Triangles are transformed and binned into screen tiles first,
+/// then every tile is rasterized independently by a pool of worker threads.
+/// Each tile owns a disjoint part of the color and depth buffers,
+/// so the workers never need to synchronize.
+Image3 render(const Scene &scene, const RenderOptions &options);
+
+bool is_inside_triangle(Vector2 p0, Vector2 p1, Vector2 p2, Vector2 p);
+Vector2 project(const Vector3 &p);
+Vector2 toScreenSpace(const Vector2 &p, int width, int height, Real s);
+Vector3 barycentric_coordinates(const Vector2 &A, const Vector2 &B, const Vector2 &C, const Vector2 &P);
+Vector3 transform_point(const Matrix4x4 &m, const Vector3 &p);
+
+} // namespace hw2
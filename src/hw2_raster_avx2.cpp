@@ -0,0 +1,71 @@
+// Built with AVX2 code generation (see CMakeLists.txt).
+// hw2::render only calls into this file after checking the CPU supports it.
+
+#include "hw2_raster_simd.h"
+
+namespace hw2 {
+
+#if defined(__AVX2__)
+
+bool avx2_kernel_compiled() {
+    return true;
+}
+
+template <typename T, int... Features>
+static RasterKernelTable<T> avx2_kernel_table(std::integer_sequence<int, Features...>) {
+    return {&simd_avx2::rasterize_triangle<T, Features>...};
+}
+
+template <typename T>
+void filter_rows_avx2(T *out, const T *const *rows, const T *weights, int taps, int count) {
+    simd_avx2::filter_rows(out, rows, weights, taps, count);
+}
+
+void shade_lights_avx2(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights) {
+    simd_avx2::shade_lights(fragments, count, lights, num_lights);
+}
+
+int64_t rasterize_depth_avx2(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                             const DepthMap &map) {
+    return simd_avx2::rasterize_depth(tri, x_min, x_max, y_min, y_max, map);
+}
+
+#else
+
+bool avx2_kernel_compiled() {
+    return false;
+}
+
+template <typename T, int... Features>
+static RasterKernelTable<T> avx2_kernel_table(std::integer_sequence<int, Features...>) {
+    return {&SIMD_NAMESPACE::rasterize_triangle<T, Features>...};
+}
+
+template <typename T>
+void filter_rows_avx2(T *out, const T *const *rows, const T *weights, int taps, int count) {
+    SIMD_NAMESPACE::filter_rows(out, rows, weights, taps, count);
+}
+
+void shade_lights_avx2(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights) {
+    SIMD_NAMESPACE::shade_lights(fragments, count, lights, num_lights);
+}
+
+int64_t rasterize_depth_avx2(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                             const DepthMap &map) {
+    return SIMD_NAMESPACE::rasterize_depth(tri, x_min, x_max, y_min, y_max, map);
+}
+
+#endif
+
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_avx2_kernels() {
+    static const RasterKernelTable<T> table = avx2_kernel_table<T>(std::make_integer_sequence<int, NUM_KERNEL_VARIANTS>());
+    return table;
+}
+
+template const RasterKernelTable<float> &rasterize_triangle_avx2_kernels<float>();
+template const RasterKernelTable<double> &rasterize_triangle_avx2_kernels<double>();
+template void filter_rows_avx2<float>(float *, const float *const *, const float *, int, int);
+template void filter_rows_avx2<double>(double *, const double *const *, const double *, int, int);
+
+} // namespace hw2
@@ -0,0 +1,311 @@
+#pragma once
+
+// Internal interface between the tile engine in hw2_raster.cpp
+// and the per-triangle pixel kernels.
+
+#include "balboa.h"
+#include "vector.h"
+#include <array>
+#include <utility>
+
+namespace hw2 {
+
+struct Texture;
+
+/// Screen positions are snapped to fixed point with this many
+/// fractional bits per super-sample before triangle setup.
+constexpr int SUBPIXEL_BITS = 8;
+constexpr int64_t SUBPIXEL_ONE = int64_t(1) << SUBPIXEL_BITS;
+
+/// A quantity varying linearly over the screen, set up once per triangle:
+///   value(x, y) = c + dx * (x - tri.x_min) + dy * (y - tri.y_min)
+/// at the center of sample (x, y). Every kernel evaluates it as
+/// row(y) + dx * (x - tri.x_min), plus shift() for samples off the cell
+/// centers, so they all agree bit for bit.
+template <typename T>
+struct AttributePlane {
+    T dx, dy, c;
+
+    T row(int y_offset) const {
+        return c + dy * T(y_offset);
+    }
+
+    /// The change from a cell center to a sample (fx, fy) super-samples off it.
+    T shift(T fx, T fy) const {
+        return dx * fx + dy * fy;
+    }
+};
+
+/// Attribute planes of the vertex colors (red, green and blue over w).
+constexpr int NUM_COLOR_ATTRIBUTES = 3;
+
+/// A triangle after vertex processing and setup, in super-sampled screen space.
+/// Edge i is the fixed-point edge function opposite to vertex i,
+///   w_i(X, Y) = A[i] * X + B[i] * Y + C[i],
+/// with X, Y in 1/SUBPIXEL_ONE super-samples. The edges are oriented so that
+/// the interior is w_i >= 0, and biased by the top-left fill rule so that
+/// samples on an edge shared by two triangles are drawn exactly once.
+/// Depth and attributes are interpolated perspective-correctly: 1/w and
+/// attribute/w are linear on the screen, so they are set up as planes, and
+/// an attribute is its plane divided by the 1/w plane.
+/// T is the scalar type of the depth and color pipeline (float or double).
+template <typename T>
+struct ScreenTriangle {
+    int64_t A[3], B[3], C[3];
+    AttributePlane<T> inv_w; // 1/w, which is also the depth (larger is nearer)
+    // attribute/w planes, the colors first; null when flat
+    const AttributePlane<T> *attributes;
+    // when set, the first two attributes are the texture coordinates (u, v),
+    // and the texture is sampled in their place by the deferred shading
+    const Texture *texture;
+    // normal/w planes in camera space when the frame is lit, else null
+    const AttributePlane<T> *normals;
+    float shininess; // specular exponent when lit
+    TVector3<T> color; // the face color when flat
+    T max_depth; // depth of the nearest vertex
+    // bounding box in super-samples, clamped to the screen (empty if x_min > x_max)
+    int x_min, x_max, y_min, y_max;
+    // true if all edge values inside the bounding box are exact in a double,
+    // which the SIMD kernels rely on
+    bool exact_in_double;
+    uint32_t id; // index of the triangle in the frame, written to the visibility buffer
+};
+
+/// Visibility-buffer entry of a sample no triangle covers.
+constexpr uint32_t NO_TRIANGLE = ~uint32_t(0);
+
+/// Largest samples per pixel axis of a pattern other than the grid.
+constexpr int MAX_PATTERN_SIZE = 8;
+
+/// Where the samples lie within their super-sample cells, for patterns other
+/// than the grid (which has every sample at the cell center and no table).
+/// The sample of cell (x, y) lies at (x, y) * SUBPIXEL_ONE + SUBPIXEL_ONE / 2
+/// + (dx[c], dy[c]) in fixed point, with c = (y % size) * size + x % size.
+/// size divides 8, so the cells of a SIMD row repeat along the row.
+struct SampleOffsets {
+    int size; // samples per pixel along each axis
+    int64_t dx[MAX_PATTERN_SIZE * MAX_PATTERN_SIZE];
+    int64_t dy[MAX_PATTERN_SIZE * MAX_PATTERN_SIZE];
+    // the same in super-samples, for the attribute planes (exact in a float)
+    float fx[MAX_PATTERN_SIZE * MAX_PATTERN_SIZE];
+    float fy[MAX_PATTERN_SIZE * MAX_PATTERN_SIZE];
+    int64_t max_offset; // the largest |dx| or |dy|
+};
+
+/// Colors a multisampled pixel can hold at once.
+constexpr int MSAA_SLOTS = 4;
+
+/// A pixel of the multisample color buffer: a few distinct colors, each
+/// with the mask of the samples it covers (bit dy * aa_factor + dx).
+/// Every sample belongs to exactly one slot; unused slots have an empty mask.
+template <typename T>
+struct MsaaPixel {
+    TVector3<T> color[MSAA_SLOTS];
+    uint64_t mask[MSAA_SLOTS];
+};
+
+/// The super-sampled color and depth buffers a kernel writes to.
+/// They hold a window of the screen starting at sample (x0, y0),
+/// e.g. the tile being rasterized.
+/// In multisample mode color is null and the colors go to pixels instead.
+/// Color may have its own stride, e.g. when it is a window of a larger buffer.
+/// In visibility-buffer mode ids is set, and the kernels only write depth
+/// and the id of the triangle, leaving the colors to a later shading pass.
+template <typename T>
+struct RasterTarget {
+    TVector3<T> *color;
+    float *depth; // 1/w, larger is nearer, always in single precision
+    uint32_t *ids; // per sample, null unless in visibility-buffer mode
+    int width; // row stride of depth and ids
+    int color_width; // row stride of color
+    MsaaPixel<T> *pixels;
+    int pixel_width; // row stride of pixels
+    int aa_factor; // samples per pixel along each axis
+    int x0, y0; // screen position of the first sample, a multiple of aa_factor
+    const SampleOffsets *pattern; // null for the grid pattern
+    TVector3<T> background; // the color of samples no triangle covers
+};
+
+/// What a pixel kernel does beyond coverage, as bits of its Features template
+/// argument. Every kernel is instantiated for each combination, so its
+/// sample loop carries no branches for the features it was built without.
+/// The renderer picks the features fixed over a frame once, and adds the
+/// ones that vary per block before calling the kernel of the block.
+enum KernelFeatures {
+    KERNEL_FLAT = 1, // the face color instead of interpolated vertex colors
+    KERNEL_VISIBILITY = 2, // write depth and triangle ids only (target.ids is set)
+    KERNEL_PATTERN = 4, // samples off the cell centers (target.pattern is set)
+    KERNEL_COVERED = 8, // the rectangle lies inside the triangle, so coverage needs no tests
+    KERNEL_DEPTH_TEST = 16, // test depth; without it, every covered sample passes
+    NUM_KERNEL_VARIANTS = 32
+};
+
+/// Rasterize the part of a triangle inside [x_min, x_max] x [y_min, y_max],
+/// depth testing every covered sample and writing color and depth where it passes.
+/// Returns the number of colors computed, or of ids written in visibility-buffer mode.
+template <typename T>
+using RasterKernel = int64_t (*)(const ScreenTriangle<T> &tri,
+                                 int x_min, int x_max, int y_min, int y_max,
+                                 const RasterTarget<T> &target);
+
+/// The instantiations of a kernel, indexed by their KernelFeatures.
+template <typename T>
+using RasterKernelTable = std::array<RasterKernel<T>, NUM_KERNEL_VARIANTS>;
+
+// Instantiated for float and double.
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_scalar_kernels();
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_sse_kernels();
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_avx2_kernels();
+/// aa_factor picks the MSAA kernels built for 1, 2, 4 or 8 samples per pixel
+/// axis, or the ones reading it from the target for the other factors.
+template <typename T>
+const RasterKernelTable<T> &rasterize_triangle_msaa_kernels(int aa_factor);
+
+/// Weigh rows of samples into one, the vertical pass of the resolve:
+/// out[i] = sum_k weights[k] * rows[k][i] for i < count.
+/// The rows are arrays of T, e.g. the channels of a run of TVector3<T>.
+template <typename T>
+using FilterRowsKernel = void (*)(T *out, const T *const *rows, const T *weights, int taps, int count);
+
+// Instantiated for float and double.
+template <typename T>
+void filter_rows_scalar(T *out, const T *const *rows, const T *weights, int taps, int count);
+template <typename T>
+void filter_rows_sse(T *out, const T *const *rows, const T *weights, int taps, int count);
+template <typename T>
+void filter_rows_avx2(T *out, const T *const *rows, const T *weights, int taps, int count);
+
+/// The shading constants of hw_3_4.fs.
+constexpr float AMBIENT_STRENGTH = 0.1f;
+constexpr float SPECULAR_STRENGTH = 0.5f;
+
+/// A directional light in camera space.
+struct ShadingLight {
+    float direction[3]; // unit vector towards the light
+    float color[3];
+};
+
+/// Fragments waiting to be lit, in structure-of-arrays layout so that a
+/// kernel lights 8 of them at a time. The arrays hold count values rounded
+/// up to a multiple of 8; the padding is lit too and ignored.
+struct LitFragments {
+    const float *albedo[3]; // the color before lighting, from the vertex colors or the texture
+    const float *normal[3]; // interpolated in camera space, not normalized
+    // (x, y) of the camera space ray (x, y, -1) through the fragment
+    const float *view[2];
+    const float *shininess;
+    // how much of light l reaches fragment i, at shadow[l * shadow_stride + i]; null without shadows
+    const float *shadow;
+    int shadow_stride;
+    float *color[3]; // the lit color, written by the kernel
+};
+
+/// Light fragments with the model of hw_3_4.fs, summed over the lights:
+///   color = albedo * sum (AMBIENT_STRENGTH + shadow * (max(N.L, 0)
+///                         + SPECULAR_STRENGTH * max(V.R, 0)^shininess)) * light color
+/// with R the reflection of -L about N, V the unit vector towards the camera,
+/// and shadow the visibility of the light, 1 without shadows.
+using ShadeLightsKernel = void (*)(const LitFragments &fragments, int count,
+                                   const ShadingLight *lights, int num_lights);
+
+/// The scalar kernel uses the exact library functions; the SIMD ones use
+/// the fast approximations of normalize and pow in simd.h.
+void shade_lights_scalar(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights);
+void shade_lights_sse(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights);
+void shade_lights_avx2(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights);
+
+/// A depth map stored in square tiles of DEPTH_TILE_SIZE samples, the tiles
+/// row by row and the samples of a tile row by row, e.g. the shadow map of
+/// a light. A row of a tile is the 8 lanes of a SIMD kernel, and the
+/// footprint of a filtered lookup touches a few cache lines.
+constexpr int DEPTH_TILE_BITS = 3;
+constexpr int DEPTH_TILE_SIZE = 1 << DEPTH_TILE_BITS;
+
+struct DepthMap {
+    float *depth; // larger is nearer, as in the depth buffer
+    int width, height; // multiples of DEPTH_TILE_SIZE
+
+    /// Index of sample (x, y) within depth.
+    int64_t index(int x, int y) const {
+        const int tiles_x = width >> DEPTH_TILE_BITS;
+        return ((int64_t(y >> DEPTH_TILE_BITS) * tiles_x + (x >> DEPTH_TILE_BITS)) << (2 * DEPTH_TILE_BITS)) +
+               ((y & (DEPTH_TILE_SIZE - 1)) << DEPTH_TILE_BITS) + (x & (DEPTH_TILE_SIZE - 1));
+    }
+};
+
+/// Rasterize the depth of the part of a triangle inside [x_min, x_max] x
+/// [y_min, y_max] into a depth map, keeping the nearest. There are no
+/// colors, ids, attributes or sample patterns: only the edges and the depth
+/// plane are evaluated. Returns the number of samples written.
+using DepthKernel = int64_t (*)(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                                const DepthMap &map);
+
+int64_t rasterize_depth_scalar(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                               const DepthMap &map);
+int64_t rasterize_depth_sse(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                            const DepthMap &map);
+int64_t rasterize_depth_avx2(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                             const DepthMap &map);
+
+/// Work counters of the rasterizer, printed by render with -stats.
+struct RasterStats {
+    int64_t culled_frustum = 0; // triangles outside the view frustum, with their mesh or on their own
+    int64_t culled_backface = 0; // triangles seen from behind on meshes with cull_backface
+    int64_t culled_no_coverage = 0; // triangles covering no sample
+    int64_t culled_degenerate = 0; // triangles of zero area or too far out to snap to fixed point
+    int64_t clipped = 0; // triangles clipped against the near or far plane or the guard band
+    int64_t refined_pixels = 0; // pixels super-sampled by edge-adaptive anti-aliasing
+    int64_t sorted_clusters = 0; // clusters of triangles ordered by the front-to-back sort
+    int64_t triangles = 0; // triangle-tile pairs rasterized
+    int64_t blocks_rejected = 0; // blocks outside an edge, skipped
+    int64_t blocks_accepted = 0; // blocks inside all edges, drawn without coverage tests
+    int64_t blocks_partial = 0; // blocks crossing an edge, tested per sample
+    int64_t triangles_occluded = 0; // triangle-tile pairs hidden behind the Hi-Z of the tile
+    int64_t blocks_occluded = 0; // blocks hidden behind the Hi-Z of the block
+    int64_t edge_tests = 0; // edge function evaluations (3 per tested sample or block)
+    int64_t blocks_cleared = 0; // blocks cleared on their first write; the others are never touched
+    int64_t shaded = 0; // colors computed (per sample, or per pixel and triangle with MSAA)
+    int64_t visibility_writes = 0; // samples that passed the depth test in visibility-buffer mode
+    int64_t visible = 0; // samples covered at the end of the frame (without MSAA)
+    int64_t shadow_triangles = 0; // triangle-tile pairs rasterized into the shadow maps
+    int64_t shadow_writes = 0; // samples written to the shadow maps
+    // the smallest and largest depth left in the buffer at the end of the frame
+    float depth_min = std::numeric_limits<float>::infinity();
+    float depth_max = -std::numeric_limits<float>::infinity();
+
+    RasterStats &operator+=(const RasterStats &other) {
+        culled_frustum += other.culled_frustum;
+        culled_backface += other.culled_backface;
+        culled_no_coverage += other.culled_no_coverage;
+        culled_degenerate += other.culled_degenerate;
+        clipped += other.clipped;
+        refined_pixels += other.refined_pixels;
+        sorted_clusters += other.sorted_clusters;
+        triangles += other.triangles;
+        blocks_rejected += other.blocks_rejected;
+        blocks_accepted += other.blocks_accepted;
+        blocks_partial += other.blocks_partial;
+        triangles_occluded += other.triangles_occluded;
+        blocks_occluded += other.blocks_occluded;
+        edge_tests += other.edge_tests;
+        blocks_cleared += other.blocks_cleared;
+        shaded += other.shaded;
+        visibility_writes += other.visibility_writes;
+        visible += other.visible;
+        shadow_triangles += other.shadow_triangles;
+        shadow_writes += other.shadow_writes;
+        depth_min = std::min(depth_min, other.depth_min);
+        depth_max = std::max(depth_max, other.depth_max);
+        return *this;
+    }
+};
+
+std::ostream& operator<<(std::ostream &os, const RasterStats &stats);
+
+/// False when hw2_raster_avx2.cpp was built without AVX2 code generation.
+bool avx2_kernel_compiled();
+
+} // namespace hw2
@@ -0,0 +1,322 @@
+#pragma once
+
+// The 8-wide pixel, depth, resolve and lighting kernels of the hw2
+// rasterizer, written once against the packs of simd.h and compiled per
+// instruction set.
+//
+// Only plain data and the SIMD_NAMESPACE functions may be used in here:
+// the file is compiled with extra ISA flags in hw2_raster_avx2.cpp, and any
+// shared inline function instantiated there could be picked by the linker
+// for the baseline build as well.
+
+#include "hw2_raster_kernel.h"
+#include "simd.h"
+
+namespace hw2 {
+namespace SIMD_NAMESPACE {
+
+using namespace ::SIMD_NAMESPACE;
+
+/// Rasterize a triangle 8 samples of a row at a time.
+/// The edge values are carried in doubles, which is exact as long as
+/// tri.exact_in_double holds, and only then rounded to floats (which keeps
+/// their signs), so coverage is exactly that of rasterize_triangle_scalar.
+/// Depth and colors come from the attribute planes, evaluated the same way
+/// as there, so they are bit-identical too. With T = float the interpolation
+/// runs on 8-float packs, half the registers of the double ones; the depth
+/// test always does, on the float depth buffer.
+/// With KERNEL_COVERED only the span mask limits the written samples.
+/// Patterns other than the grid move each lane's samples by a fixed offset
+/// per row, which is added to the edges and the planes.
+/// With KERNEL_VISIBILITY only depth and the triangle id are written.
+template <typename T, int Features>
+inline int64_t rasterize_triangle(const ScreenTriangle<T> &tri,
+                                  int x_min, int x_max, int y_min, int y_max,
+                                  const RasterTarget<T> &target) {
+    constexpr bool flat = Features & KERNEL_FLAT;
+    constexpr bool visibility = Features & KERNEL_VISIBILITY;
+    constexpr bool has_pattern = Features & KERNEL_PATTERN;
+    constexpr bool covered = Features & KERNEL_COVERED;
+    constexpr bool depth_test = Features & KERNEL_DEPTH_TEST;
+    using Pack = typename Pack8<T>::type;
+    const int64_t half = SUBPIXEL_ONE / 2;
+    const Double8 lanes = Double8::lane_index();
+    const Pack pack_lanes = Pack::lane_index();
+    const Float8 float_lanes = Float8::lane_index();
+    const Float8 zero = Float8::set1(0.f);
+    const Pack one = Pack::set1(T(1));
+
+    int64_t step_x[3], w_row[3];
+    Double8 lane_step[3];
+    for (int i = 0; i < 3; i++) {
+        step_x[i] = tri.A[i] * SUBPIXEL_ONE;
+        w_row[i] = tri.A[i] * (x_min * SUBPIXEL_ONE + half) +
+                   tri.B[i] * (y_min * SUBPIXEL_ONE + half) + tri.C[i];
+        lane_step[i] = lanes * Double8::set1(double(step_x[i]));
+    }
+    const Pack inv_w_dx = Pack::set1(tri.inv_w.dx);
+    Pack attribute_dx[NUM_COLOR_ATTRIBUTES];
+    if (!flat) {
+        for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+            attribute_dx[k] = Pack::set1(tri.attributes[k].dx);
+        }
+    }
+
+    // With a pattern, the lanes step 8 samples at a time, so each keeps its
+    // pattern column along a row, and the shifts of the row are per lane.
+    const SampleOffsets *pattern = target.pattern;
+    alignas(32) T color[NUM_COLOR_ATTRIBUTES][8];
+    alignas(32) double edge_shift[8];
+    alignas(32) T plane_shift[8];
+    Double8 row_lane_step[3] = {lane_step[0], lane_step[1], lane_step[2]};
+    Pack inv_w_shift = Pack::set1(T(0));
+    Pack attribute_shift[NUM_COLOR_ATTRIBUTES];
+    for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+        attribute_shift[k] = inv_w_shift;
+    }
+    int64_t shaded = 0;
+    for (int y = y_min; y <= y_max; y++) {
+        if constexpr (has_pattern) {
+            const int row_cell = (y % pattern->size) * pattern->size;
+            for (int i = 0; i < 3; i++) {
+                for (int lane = 0; lane < 8; lane++) {
+                    int cell = row_cell + (x_min + lane) % pattern->size;
+                    edge_shift[lane] = double(tri.A[i] * pattern->dx[cell] + tri.B[i] * pattern->dy[cell]);
+                }
+                row_lane_step[i] = lane_step[i] + load(edge_shift);
+            }
+            for (int k = -1; k < (flat ? 0 : NUM_COLOR_ATTRIBUTES); k++) {
+                const AttributePlane<T> &plane = k < 0 ? tri.inv_w : tri.attributes[k];
+                for (int lane = 0; lane < 8; lane++) {
+                    int cell = row_cell + (x_min + lane) % pattern->size;
+                    plane_shift[lane] = plane.shift(T(pattern->fx[cell]), T(pattern->fy[cell]));
+                }
+                (k < 0 ? inv_w_shift : attribute_shift[k]) = load(plane_shift);
+            }
+        }
+        float *depth_row = target.depth + int64_t(y - target.y0) * target.width;
+        TVector3<T> *color_row = target.color + int64_t(y - target.y0) * target.color_width;
+        uint32_t *id_row = visibility ? target.ids + int64_t(y - target.y0) * target.width : nullptr;
+        const Pack inv_w_row = Pack::set1(tri.inv_w.row(y - tri.y_min));
+        Pack attribute_row[NUM_COLOR_ATTRIBUTES];
+        if (!flat) {
+            for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+                attribute_row[k] = Pack::set1(tri.attributes[k].row(y - tri.y_min));
+            }
+        }
+        for (int x = x_min; x <= x_max; x += 8) {
+            // Coverage of the 8 samples, masked to the ones inside the span
+            Float8 inside = Float8::set1(float(x_max - x)) >= float_lanes;
+            if (!covered) {
+                for (int i = 0; i < 3; i++) {
+                    Float8 w;
+                    convert(Double8::set1(double(w_row[i] + (x - x_min) * step_x[i])) + row_lane_step[i], w);
+                    inside = inside & (w >= zero);
+                }
+                if (movemask(inside) == 0) {
+                    continue;
+                }
+            }
+
+            // Columns relative to the planes, small integers that are exact in T
+            const Pack column = Pack::set1(T(x - tri.x_min)) + pack_lanes;
+            Pack depth = inv_w_row + inv_w_dx * column;
+            if constexpr (has_pattern) {
+                depth = depth + inv_w_shift;
+            }
+
+            Float8 stored;
+            convert(depth, stored);
+
+            const int i0 = x - target.x0;
+            Float8 pass = depth_test ? inside & (stored > load_masked(depth_row + i0, inside)) : inside;
+            int pass_bits = movemask(pass);
+            if (pass_bits == 0) {
+                continue;
+            }
+            store_masked(depth_row + i0, pass, stored);
+            for (int bits = pass_bits; bits != 0; bits &= bits - 1) {
+                shaded++;
+            }
+
+            if (visibility) {
+                for (int lane = 0; lane < 8; lane++) {
+                    if (pass_bits & (1 << lane)) {
+                        id_row[i0 + lane] = tri.id;
+                    }
+                }
+            } else if (flat) {
+                for (int lane = 0; lane < 8; lane++) {
+                    if (pass_bits & (1 << lane)) {
+                        color_row[i0 + lane] = tri.color;
+                    }
+                }
+            } else {
+                Pack w = one / depth;
+                for (int k = 0; k < NUM_COLOR_ATTRIBUTES; k++) {
+                    Pack value = attribute_row[k] + attribute_dx[k] * column;
+                    if constexpr (has_pattern) {
+                        value = value + attribute_shift[k];
+                    }
+                    store(color[k], value * w);
+                }
+                for (int lane = 0; lane < 8; lane++) {
+                    if (pass_bits & (1 << lane)) {
+                        TVector3<T> &c = color_row[i0 + lane];
+                        c.x = color[0][lane];
+                        c.y = color[1][lane];
+                        c.z = color[2][lane];
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            w_row[i] += tri.B[i] * SUBPIXEL_ONE;
+        }
+    }
+    return shaded;
+}
+
+/// Rasterize the depth of a triangle into a tiled depth map, as declared
+/// with DepthKernel. Every step covers one row of a tile, 8 aligned samples
+/// loaded and stored whole; the edges are masked to [x_min, x_max] like the
+/// span of rasterize_triangle. Coverage and depth are exactly those of
+/// rasterize_depth_scalar as long as tri.exact_in_double holds.
+inline int64_t rasterize_depth(const ScreenTriangle<float> &tri, int x_min, int x_max, int y_min, int y_max,
+                               const DepthMap &map) {
+    const int64_t half = SUBPIXEL_ONE / 2;
+    const Double8 lanes = Double8::lane_index();
+    const Float8 float_lanes = Float8::lane_index();
+    const Float8 zero = Float8::set1(0.f);
+    const int x_start = x_min & ~(DEPTH_TILE_SIZE - 1);
+
+    int64_t step_x[3], w_row[3];
+    Double8 lane_step[3];
+    for (int i = 0; i < 3; i++) {
+        step_x[i] = tri.A[i] * SUBPIXEL_ONE;
+        w_row[i] = tri.A[i] * (x_start * SUBPIXEL_ONE + half) +
+                   tri.B[i] * (y_min * SUBPIXEL_ONE + half) + tri.C[i];
+        lane_step[i] = lanes * Double8::set1(double(step_x[i]));
+    }
+    const Float8 depth_dx = Float8::set1(tri.inv_w.dx);
+    int64_t written = 0;
+    for (int y = y_min; y <= y_max; y++) {
+        const Float8 depth_row = Float8::set1(tri.inv_w.row(y - tri.y_min));
+        for (int x = x_start; x <= x_max; x += DEPTH_TILE_SIZE) {
+            Float8 inside = (Float8::set1(float(x_max - x)) >= float_lanes) &
+                            (float_lanes >= Float8::set1(float(x_min - x)));
+            for (int i = 0; i < 3; i++) {
+                Float8 w;
+                convert(Double8::set1(double(w_row[i] + (x - x_start) * step_x[i])) + lane_step[i], w);
+                inside = inside & (w >= zero);
+            }
+            if (movemask(inside) == 0) {
+                continue;
+            }
+            const Float8 depth = depth_row + depth_dx * (Float8::set1(float(x - tri.x_min)) + float_lanes);
+            float *row = map.depth + map.index(x, y);
+            const Float8 stored = load(row);
+            const Float8 pass = inside & (depth > stored);
+            int pass_bits = movemask(pass);
+            if (pass_bits == 0) {
+                continue;
+            }
+            // The row of the tile is written whole, which is cheaper than a masked store
+            store(row, select(pass, depth, stored));
+            for (; pass_bits != 0; pass_bits &= pass_bits - 1) {
+                written++;
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            w_row[i] += tri.B[i] * SUBPIXEL_ONE;
+        }
+    }
+    return written;
+}
+
+/// Weigh rows of samples into one, 8 values at a time:
+/// out[i] = sum_k weights[k] * rows[k][i] for i < count, summed in the
+/// order of k like filter_rows_scalar, so the results are bit-identical.
+template <typename T>
+inline void filter_rows(T *out, const T *const *rows, const T *weights, int taps, int count) {
+    using Pack = typename Pack8<T>::type;
+    int i = 0;
+    // Two packs at a time, so two chains of additions are in flight
+    for (; i + 16 <= count; i += 16) {
+        Pack w = Pack::set1(weights[0]);
+        Pack sum0 = w * load(rows[0] + i), sum1 = w * load(rows[0] + i + 8);
+        for (int k = 1; k < taps; k++) {
+            w = Pack::set1(weights[k]);
+            sum0 = sum0 + w * load(rows[k] + i);
+            sum1 = sum1 + w * load(rows[k] + i + 8);
+        }
+        store(out + i, sum0);
+        store(out + i + 8, sum1);
+    }
+    for (; i + 8 <= count; i += 8) {
+        Pack sum = Pack::set1(weights[0]) * load(rows[0] + i);
+        for (int k = 1; k < taps; k++) {
+            sum = sum + Pack::set1(weights[k]) * load(rows[k] + i);
+        }
+        store(out + i, sum);
+    }
+    for (; i < count; i++) {
+        T sum = weights[0] * rows[0][i];
+        for (int k = 1; k < taps; k++) {
+            sum = sum + weights[k] * rows[k][i];
+        }
+        out[i] = sum;
+    }
+}
+
+/// Light 8 fragments at a time, as declared with ShadeLightsKernel.
+/// Normalize and pow are the fast approximations of simd.h, which are
+/// well within the precision of an 8-bit output.
+inline void shade_lights(const LitFragments &fragments, int count, const ShadingLight *lights, int num_lights) {
+    const Float8 zero = Float8::set1(0.f), one = Float8::set1(1.f), two = Float8::set1(2.f);
+    const Float8 ambient = Float8::set1(AMBIENT_STRENGTH), specular_strength = Float8::set1(SPECULAR_STRENGTH);
+    for (int i = 0; i < count; i += 8) {
+        Float8 nx = load(fragments.normal[0] + i);
+        Float8 ny = load(fragments.normal[1] + i);
+        Float8 nz = load(fragments.normal[2] + i);
+        Float8 inv_length = fast_rsqrt(max(nx * nx + ny * ny + nz * nz, Float8::set1(1e-30f)));
+        nx = nx * inv_length;
+        ny = ny * inv_length;
+        nz = nz * inv_length;
+        // Towards the camera, against the ray through the fragment
+        Float8 vx = zero - load(fragments.view[0] + i);
+        Float8 vy = zero - load(fragments.view[1] + i);
+        Float8 vz = fast_rsqrt(vx * vx + vy * vy + one);
+        vx = vx * vz;
+        vy = vy * vz;
+        const Float8 shininess = load(fragments.shininess + i);
+
+        Float8 light[3] = {zero, zero, zero};
+        for (int l = 0; l < num_lights; l++) {
+            const Float8 lx = Float8::set1(lights[l].direction[0]);
+            const Float8 ly = Float8::set1(lights[l].direction[1]);
+            const Float8 lz = Float8::set1(lights[l].direction[2]);
+            Float8 n_dot_l = nx * lx + ny * ly + nz * lz;
+            // reflect(-L, N) = 2 (N.L) N - L
+            Float8 twice = two * n_dot_l;
+            Float8 rx = twice * nx - lx, ry = twice * ny - ly, rz = twice * nz - lz;
+            Float8 spec = fast_pow(max(vx * rx + vy * ry + vz * rz, zero), shininess);
+            Float8 strength;
+            if (fragments.shadow) {
+                const Float8 visibility = load(fragments.shadow + l * fragments.shadow_stride + i);
+                strength = ambient + visibility * (max(n_dot_l, zero) + specular_strength * spec);
+            } else {
+                strength = ambient + max(n_dot_l, zero) + specular_strength * spec;
+            }
+            for (int c = 0; c < 3; c++) {
+                light[c] = light[c] + strength * Float8::set1(lights[l].color[c]);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            store(fragments.color[c] + i, light[c] * load(fragments.albedo[c] + i));
+        }
+    }
+}
+
+} // namespace SIMD_NAMESPACE
+} // namespace hw2
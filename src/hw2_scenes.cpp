@@ -3,6 +3,7 @@
 #include "3rdparty/tinyply.h"
 #include "flexception.h"
 #include <fstream>
+#include <map>
 
 using json = nlohmann::json;
 
@@ -121,7 +122,7 @@ TriangleMesh parse_ply(const fs::path &filename) {
     tinyply::PlyFile ply_file;
     ply_file.parse_header(ifs);
 
-    std::shared_ptr<tinyply::PlyData> vertices, faces, vertex_colors;
+    std::shared_ptr<tinyply::PlyData> vertices, faces, vertex_colors, uvs, vertex_normals;
     try {
         vertices = ply_file.request_properties_from_element("vertex", { "x", "y", "z" }); 
     } catch (const std::exception & e) { 
@@ -137,6 +138,16 @@ TriangleMesh parse_ply(const fs::path &filename) {
     } catch (const std::exception & e) {
         Error(std::string("Vertex colors not found in ") + filename.string());
     }
+    try {
+        uvs = ply_file.request_properties_from_element("vertex", {"s", "t"});
+    } catch (const std::exception &e) {
+        // Only textured meshes need UVs
+    }
+    try {
+        vertex_normals = ply_file.request_properties_from_element("vertex", {"nx", "ny", "nz"});
+    } catch (const std::exception &e) {
+        // Normals are computed from the faces if a lit scene needs them
+    }
     assert(vertices->count == vertex_colors->count);
 
     ply_file.read(ifs);
@@ -183,6 +194,44 @@ TriangleMesh parse_ply(const fs::path &filename) {
     } else {
         Error(std::string("Unknown type of vertex colors in ") + filename.string());
     }
+
+    if (uvs && uvs->count > 0) {
+        mesh.uvs.resize(uvs->count);
+        if (uvs->t == tinyply::Type::FLOAT32) {
+            float *data = (float*)uvs->buffer.get();
+            for (size_t i = 0; i < uvs->count; i++) {
+                mesh.uvs[i] = Vector2{
+                    data[2 * i], data[2 * i + 1]};
+            }
+        } else if (uvs->t == tinyply::Type::FLOAT64) {
+            double *data = (double*)uvs->buffer.get();
+            for (size_t i = 0; i < uvs->count; i++) {
+                mesh.uvs[i] = Vector2{
+                    data[2 * i], data[2 * i + 1]};
+            }
+        } else {
+            Error(std::string("Unknown type of UV in ") + filename.string());
+        }
+    }
+
+    if (vertex_normals && vertex_normals->count > 0) {
+        mesh.vertex_normals.resize(vertex_normals->count);
+        if (vertex_normals->t == tinyply::Type::FLOAT32) {
+            float *data = (float*)vertex_normals->buffer.get();
+            for (size_t i = 0; i < vertex_normals->count; i++) {
+                mesh.vertex_normals[i] = Vector3{
+                    data[3 * i], data[3 * i + 1], data[3 * i + 2]};
+            }
+        } else if (vertex_normals->t == tinyply::Type::FLOAT64) {
+            double *data = (double*)vertex_normals->buffer.get();
+            for (size_t i = 0; i < vertex_normals->count; i++) {
+                mesh.vertex_normals[i] = Vector3{
+                    data[3 * i], data[3 * i + 1], data[3 * i + 2]};
+            }
+        } else {
+            Error(std::string("Unknown type of vertex normals in ") + filename.string());
+        }
+    }
     
     mesh.faces.resize(faces->count);
     if (faces->t == tinyply::Type::INT8) {
@@ -228,6 +277,46 @@ TriangleMesh parse_ply(const fs::path &filename) {
     return mesh;
 }
 
+/**
+ * Fit the bounding sphere of a mesh around the center of its bounding box
+ * @param mesh The mesh, whose bound_center and bound_radius are set
+ */
+void compute_bounding_sphere(TriangleMesh &mesh) {
+    if (mesh.vertices.empty()) {
+        mesh.bound_center = Vector3{0, 0, 0};
+        mesh.bound_radius = 0;
+        return;
+    }
+    Vector3 p_min = mesh.vertices[0], p_max = mesh.vertices[0];
+    for (const Vector3 &v : mesh.vertices) {
+        p_min = Vector3{min(p_min.x, v.x), min(p_min.y, v.y), min(p_min.z, v.z)};
+        p_max = Vector3{max(p_max.x, v.x), max(p_max.y, v.y), max(p_max.z, v.z)};
+    }
+    mesh.bound_center = (p_min + p_max) / Real(2);
+    Real radius_squared = 0;
+    for (const Vector3 &v : mesh.vertices) {
+        radius_squared = max(radius_squared, length_squared(v - mesh.bound_center));
+    }
+    mesh.bound_radius = sqrt(radius_squared);
+}
+
+void compute_vertex_normals(TriangleMesh &mesh) {
+    mesh.vertex_normals.assign(mesh.vertices.size(), Vector3{0, 0, 0});
+    for (const Vector3i &face : mesh.faces) {
+        // The cross product is twice the area along the normal of a counter-clockwise face
+        Vector3 n = cross(mesh.vertices[face[1]] - mesh.vertices[face[0]],
+                          mesh.vertices[face[2]] - mesh.vertices[face[0]]);
+        for (int i = 0; i < 3; i++) {
+            mesh.vertex_normals[face[i]] += n;
+        }
+    }
+    for (Vector3 &n : mesh.vertex_normals) {
+        if (length_squared(n) > 0) {
+            n = normalize(n);
+        }
+    }
+}
+
 Matrix4x4 scale_matrix(const Vector3 &scale) {
     return Matrix4x4(
             Real(scale.x), Real(0), Real(0), Real(0),
@@ -272,17 +361,11 @@ return Matrix4x4(
 );
 }
 
-Matrix4x4 parse_transformation(const json &node) {
+Matrix4x4 parse_transform_list(const json &transform) {
 // Homework 2.4: parse a sequence of linear transformation and
 // combine them into a 4x4 transformation matrix
 Matrix4x4 F = Matrix4x4::identity();
-auto transform_it = node.find("transform");
-if (transform_it == node.end()) {
-    // Transformation not specified, return identity.
-    return F;
-}
-
-for (auto it = transform_it->begin(); it != transform_it->end(); it++) {
+for (auto it = transform.begin(); it != transform.end(); it++) {
     if (auto scale_it = it->find("scale"); scale_it != it->end()) {
         Vector3 scale = Vector3{
             (*scale_it)[0], (*scale_it)[1], (*scale_it)[2]
@@ -333,6 +416,15 @@ for (auto it = transform_it->begin(); it != transform_it->end(); it++) {
 return F;
 }
 
+Matrix4x4 parse_transformation(const json &node) {
+    auto transform_it = node.find("transform");
+    if (transform_it == node.end()) {
+        // Transformation not specified, return identity.
+        return Matrix4x4::identity();
+    }
+    return parse_transform_list(*transform_it);
+}
+
 Scene parse_scene(const fs::path &filename) {
     std::ifstream f(filename.string().c_str());
     json data = json::parse(f);
@@ -364,6 +456,15 @@ Scene parse_scene(const fs::path &filename) {
     if (auto z_near = camera->find("z_near"); z_near != camera->end()) {
         scene.camera.z_near = *z_near;
     }
+    if (auto z_far = camera->find("z_far"); z_far != camera->end()) {
+        scene.camera.z_far = *z_far;
+    }
+    if (auto aa_factor = camera->find("aa_factor"); aa_factor != camera->end()) {
+        scene.camera.anti_aliasing.aa_factor = *aa_factor;
+    }
+    if (auto pattern = camera->find("sample_pattern"); pattern != camera->end()) {
+        scene.camera.anti_aliasing.pattern = parse_sample_pattern(*pattern);
+    }
 
     auto background = data.find("background");
     scene.background = Vector3{1, 1, 1};
@@ -373,14 +474,29 @@ Scene parse_scene(const fs::path &filename) {
         };
     }
 
-    auto objects = data.find("objects");
-    for (auto it = objects->begin(); it != objects->end(); it++) {
+    if (auto lights = data.find("lights"); lights != data.end()) {
+        for (auto it = lights->begin(); it != lights->end(); it++) {
+            Light light{Vector3{1, 1, 1}, Vector3{1, 1, 1}};
+            if (auto position = it->find("position"); position != it->end()) {
+                light.position = Vector3{(*position)[0], (*position)[1], (*position)[2]};
+            }
+            if (auto color = it->find("color"); color != it->end()) {
+                light.color = Vector3{(*color)[0], (*color)[1], (*color)[2]};
+            }
+            scene.lights.push_back(light);
+        }
+    }
+
+    // textures already loaded, by file name
+    std::map<std::string, int> texture_ids;
+    // Load the mesh of an object or of an instances block, without its transform
+    auto parse_mesh = [&](const json &node) {
         TriangleMesh mesh;
-        if (auto fn_it = it->find("filename"); fn_it != it->end()) {
+        if (auto fn_it = node.find("filename"); fn_it != node.end()) {
             mesh = parse_ply(std::string(*fn_it));
         } else {
-            auto vertices_it = it->find("vertices");
-            if (vertices_it != it->end()) {
+            auto vertices_it = node.find("vertices");
+            if (vertices_it != node.end()) {
                 int num_vertices = vertices_it->size() / 3;
                 mesh.vertices.resize(num_vertices);
                 for (int i = 0; i < num_vertices; i++) {
@@ -391,8 +507,8 @@ Scene parse_scene(const fs::path &filename) {
                     };
                 }
             }
-            auto faces_it = it->find("faces");
-            if (faces_it != it->end()) {
+            auto faces_it = node.find("faces");
+            if (faces_it != node.end()) {
                 int num_triangles = faces_it->size() / 3;
                 mesh.faces.resize(num_triangles);
                 for (int i = 0; i < num_triangles; i++) {
@@ -403,13 +519,13 @@ Scene parse_scene(const fs::path &filename) {
                     };
                 }
             }
-            auto vertex_colors_it = it->find("vertex_colors");
-            if (vertex_colors_it != it->end()) {
+            auto vertex_colors_it = node.find("vertex_colors");
+            if (vertex_colors_it != node.end()) {
                 int num_vertices = vertex_colors_it->size() / 3;
                 mesh.vertex_colors.resize(num_vertices);
                 if (mesh.vertex_colors.size() != mesh.vertices.size()) {
                     Error("Mesh has different number of vertices and number of colors.");
-                    return scene;
+                    return mesh;
                 }
                 for (int i = 0; i < num_vertices; i++) {
                     mesh.vertex_colors[i] = Vector3{
@@ -421,8 +537,77 @@ Scene parse_scene(const fs::path &filename) {
             }
         }
         
-        mesh.model_matrix = parse_transformation(*it);
-        scene.meshes.push_back(mesh);
+        if (auto cull_it = node.find("cull_backface"); cull_it != node.end()) {
+            mesh.cull_backface = *cull_it;
+        }
+        if (auto shininess_it = node.find("shininess"); shininess_it != node.end()) {
+            mesh.shininess = *shininess_it;
+        }
+        if (auto texture_it = node.find("texture"); texture_it != node.end()) {
+            if (mesh.uvs.size() != mesh.vertices.size()) {
+                Error("Textured mesh does not have UVs for every vertex.");
+                return mesh;
+            }
+            std::string texture_name = *texture_it;
+            if (auto id_it = texture_ids.find(texture_name); id_it != texture_ids.end()) {
+                mesh.texture = id_it->second;
+            } else {
+                mesh.texture = (int)scene.textures.size();
+                scene.textures.push_back(load_texture(texture_name));
+                texture_ids[texture_name] = mesh.texture;
+            }
+        }
+        // Reorder the faces and vertices for cache locality if the scene asks for it ("reorder": true);
+        // the file order is kept by default, since the order of faces at equal depth shows in the image
+        mesh.file_order_caches = simulate_mesh_caches(mesh.faces, sizeof(Vector3));
+        if (auto reorder_it = node.find("reorder"); reorder_it != node.end() && *reorder_it) {
+            MeshOrder order = optimize_mesh_order(mesh.vertices, mesh.faces);
+            mesh.face_colors = permuted(mesh.face_colors, order.faces);
+            mesh.vertex_colors = permuted(mesh.vertex_colors, order.vertices);
+            mesh.uvs = permuted(mesh.uvs, order.vertices);
+            mesh.vertex_normals = permuted(mesh.vertex_normals, order.vertices);
+        }
+        mesh.caches = simulate_mesh_caches(mesh.faces, sizeof(Vector3));
+        if (!scene.lights.empty() && mesh.vertex_normals.size() != mesh.vertices.size()) {
+            compute_vertex_normals(mesh);
+        }
+        compute_bounding_sphere(mesh);
+        return mesh;
+    };
+
+    if (auto objects = data.find("objects"); objects != data.end()) {
+        for (auto it = objects->begin(); it != objects->end(); it++) {
+            TriangleMesh mesh = parse_mesh(*it);
+            mesh.model_matrix = parse_transformation(*it);
+            scene.meshes.push_back(std::move(mesh));
+        }
+    }
+    // An instances block loads its mesh once and draws it with every one of
+    // its transforms, and optionally a color per transform
+    if (auto instances = data.find("instances"); instances != data.end()) {
+        for (auto it = instances->begin(); it != instances->end(); it++) {
+            TriangleMesh mesh = parse_mesh(*it);
+            mesh.model_matrix = Matrix4x4::identity();
+            auto transforms_it = it->find("transforms");
+            if (transforms_it == it->end()) {
+                Error("Instances do not contain the field \"transforms\".");
+                return scene;
+            }
+            auto colors_it = it->find("colors");
+            if (colors_it != it->end() && colors_it->size() != transforms_it->size()) {
+                Error("Instances have different number of transforms and colors.");
+                return scene;
+            }
+            mesh.instances.resize(transforms_it->size());
+            for (int i = 0; i < (int)mesh.instances.size(); i++) {
+                mesh.instances[i].model_matrix = parse_transform_list((*transforms_it)[i]);
+                if (colors_it != it->end()) {
+                    const json &color = (*colors_it)[i];
+                    mesh.instances[i].color = Vector3{color[0], color[1], color[2]};
+                }
+            }
+            scene.meshes.push_back(std::move(mesh));
+        }
     }
 
     // switch back to the old current working directory
@@ -436,6 +621,9 @@ std::ostream& operator<<(std::ostream &os, const Camera &camera) {
     os << "\tresolution=" << camera.resolution << std::endl;
     os << "\ts=" << camera.s << std::endl;
     os << "\tz_near=" << camera.z_near << std::endl;
+    os << "\tz_far=" << camera.z_far << std::endl;
+    os << "\taa_factor=" << camera.anti_aliasing.aa_factor << std::endl;
+    os << "\tsample_pattern=" << camera.anti_aliasing.pattern << std::endl;
     os << "]";
     return os;
 }
@@ -444,7 +632,13 @@ std::ostream& operator<<(std::ostream &os, const TriangleMesh &mesh) {
     os << "TriangleMesh[" << std::endl;
     os << "\tnum_vertices=" << mesh.vertices.size() << std::endl;
     os << "\tnum_faces=" << mesh.faces.size() << std::endl;
+    os << "\tfile_order_caches=" << mesh.file_order_caches << std::endl;
+    os << "\tcaches=" << mesh.caches << std::endl;
+    os << "\ttexture=" << mesh.texture << std::endl;
     os << "\ttransform=" << std::endl << mesh.model_matrix << std::endl;
+    if (!mesh.instances.empty()) {
+        os << "\tnum_instances=" << mesh.instances.size() << std::endl;
+    }
     os << "]";
     return os;
 }
@@ -453,6 +647,9 @@ std::ostream& operator<<(std::ostream &os, const Scene &scene) {
     os << "Scene[" << std::endl;
     os << "\t" << scene.camera << std::endl;
     os << "\tBackground:" << scene.background << std::endl;
+    for (const Light &light : scene.lights) {
+        os << "\tLight[position=" << light.position << ", color=" << light.color << "]" << std::endl;
+    }
     for (auto s : scene.meshes) {
         os << "\t" << s << std::endl;
     }
@@ -1,20 +1,50 @@
 #pragma once
 
 #include "balboa.h"
+#include "hw2_texture.h"
 #include "matrix.h"
+#include "mesh_order.h"
+#include "sample_pattern.h"
 #include "vector.h"
+#include <optional>
 #include <vector>
 
 namespace hw2 {
 
+/// One copy of a mesh of an "instances" block of a scene, drawn with its own
+/// transform. All the copies share the geometry of the mesh.
+struct MeshInstance {
+    Matrix4x4 model_matrix;
+    std::optional<Vector3> color; // replaces the vertex colors of the mesh if set
+};
+
 struct TriangleMesh {
     std::vector<Vector3> vertices; // 3D positions of the vertices
     std::vector<Vector3i> faces; // indices of the triangles
     std::vector<Vector3> face_colors; // per-face color of the mesh, only used in HW 2.2
     std::vector<Vector3> vertex_colors; // per-vertex color of the mesh, used in HW 2.3 and later
+    std::vector<Vector2> uvs; // per-vertex texture coordinates, only needed by textured meshes
+    std::vector<Vector3> vertex_normals; // per-vertex normals, only needed in lit scenes
+    int texture = -1; // index into Scene::textures, replacing the vertex colors; -1 if untextured
     Matrix4x4 model_matrix; // used in HW 2.4
+    // if not empty, the mesh is drawn once per instance, in place of model_matrix
+    std::vector<MeshInstance> instances;
+    bool cull_backface = false; // skip the faces seen from behind
+    Real shininess = 32; // specular exponent in lit scenes, the one of hw_3_4.fs by default
+    // bounding sphere of the vertices in object space, for frustum culling;
+    // a negative radius means it was not computed and the mesh is never culled
+    Vector3 bound_center;
+    Real bound_radius = -1;
+    // vertex cache misses of the faces as loaded, and as drawn (reordered if the scene asks, see mesh_order.h)
+    MeshCacheStats file_order_caches, caches;
 };
 
+/// Fit the bounding sphere of a mesh around the center of its bounding box.
+void compute_bounding_sphere(TriangleMesh &mesh);
+
+/// Give every vertex the area-weighted average of the normals of its faces.
+void compute_vertex_normals(TriangleMesh &mesh);
+
 extern std::vector<TriangleMesh> meshes;
 
 struct Camera {
@@ -22,12 +52,23 @@ struct Camera {
     Vector2i resolution;
     Real s; // tan(vfov/2)
     Real z_near;
+    Real z_far = std::numeric_limits<Real>::infinity();
+    AntiAliasing anti_aliasing;
+};
+
+/// A light of the shading model of hw_3_4.fs. Like lightPos there, the
+/// position only gives the direction the light comes from.
+struct Light {
+    Vector3 position;
+    Vector3 color;
 };
 
 struct Scene {
     Camera camera;
     Vector3 background;
     std::vector<TriangleMesh> meshes;
+    std::vector<Texture> textures; // shared by the meshes naming the same file
+    std::vector<Light> lights; // the meshes are lit if there are any
 };
 
 Scene parse_scene(const fs::path &filename);
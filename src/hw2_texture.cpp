@@ -0,0 +1,152 @@
+#include "hw2_texture.h"
+#include "flexception.h"
+
+namespace hw2 {
+
+/**
+ * Allocate a mip level in the tiled layout, padded to whole tiles
+ * @param width The width in texels
+ * @param height The height in texels
+ * @return The level, with every texel zero
+ */
+static MipLevel make_level(int width, int height) {
+    MipLevel level;
+    level.width = width;
+    level.height = height;
+    level.tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    int tiles_y = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    level.texels.assign(int64_t(level.tiles_x) * tiles_y * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE,
+                        Vector3f{0, 0, 0});
+    return level;
+}
+
+/**
+ * The texels of a row or column of a mip level that are averaged into one
+ * texel of the next coarser level. Those are a pair, except at the end of an
+ * odd-sized level, where the texel left over joins the last pair in a box of
+ * three.
+ * @param i The texel of the coarser level
+ * @param fine_size The size of the finer level
+ * @param coarse_size The size of the coarser level
+ * @param index The texels of the finer level
+ * @param weight Their weights
+ * @return The number of texels, 1 to 3
+ */
+static int box_taps(int i, int fine_size, int coarse_size, int index[3], float weight[3]) {
+    if (fine_size == 1) {
+        index[0] = 0;
+        weight[0] = 1;
+        return 1;
+    }
+    const int count = fine_size % 2 == 1 && i == coarse_size - 1 ? 3 : 2;
+    for (int k = 0; k < count; k++) {
+        index[k] = 2 * i + k;
+        weight[k] = 1.f / count;
+    }
+    return count;
+}
+
+Texture make_texture(const Image3 &img) {
+    if (img.width <= 0 || img.height <= 0) {
+        Error("Cannot make a texture out of an empty image.");
+    }
+    Texture texture;
+    // Flip the rows, so that v = 0 is the bottom row
+    MipLevel base = make_level(img.width, img.height);
+    for (int y = 0; y < img.height; y++) {
+        for (int x = 0; x < img.width; x++) {
+            base.texels[base.index(x, y)] = Vector3f(img(x, img.height - 1 - y));
+        }
+    }
+    texture.levels.push_back(std::move(base));
+
+    while (texture.levels.back().width > 1 || texture.levels.back().height > 1) {
+        const MipLevel &fine = texture.levels.back();
+        MipLevel coarse = make_level(max(fine.width / 2, 1), max(fine.height / 2, 1));
+        for (int y = 0; y < coarse.height; y++) {
+            int ys[3], xs[3];
+            float wy[3], wx[3];
+            const int ny = box_taps(y, fine.height, coarse.height, ys, wy);
+            for (int x = 0; x < coarse.width; x++) {
+                const int nx = box_taps(x, fine.width, coarse.width, xs, wx);
+                Vector3f sum{0, 0, 0};
+                for (int j = 0; j < ny; j++) {
+                    for (int i = 0; i < nx; i++) {
+                        sum += fine.texels[fine.index(xs[i], ys[j])] * (wx[i] * wy[j]);
+                    }
+                }
+                coarse.texels[coarse.index(x, y)] = sum;
+            }
+        }
+        texture.levels.push_back(std::move(coarse));
+    }
+    return texture;
+}
+
+Texture load_texture(const fs::path &filename) {
+    return make_texture(imread3(filename));
+}
+
+Real mip_level(const Texture &texture, Real dudx, Real dvdx, Real dudy, Real dvdy) {
+    const Real width = texture.levels[0].width, height = texture.levels[0].height;
+    Real along_x = (dudx * width) * (dudx * width) + (dvdx * height) * (dvdx * height);
+    Real along_y = (dudy * width) * (dudy * width) + (dvdy * height) * (dvdy * height);
+    // log2 of the square root of the longer one
+    return Real(0.5) * std::log2(max(max(along_x, along_y), Real(1e-30)));
+}
+
+/**
+ * Bilinear lookup in one mip level, wrapping around at the borders
+ * @param level The mip level
+ * @param u The horizontal texture coordinate
+ * @param v The vertical texture coordinate, 0 at the bottom
+ * @return The texels around (u, v), weighted by their distance
+ */
+static Vector3f sample_bilinear(const MipLevel &level, Real u, Real v) {
+    // Texel centers lie at half-integers
+    Real x = (u - std::floor(u)) * level.width - Real(0.5);
+    Real y = (v - std::floor(v)) * level.height - Real(0.5);
+    int x0 = int(std::floor(x)), y0 = int(std::floor(y));
+    float fx = float(x - x0), fy = float(y - y0);
+    int x1 = x0 + 1, y1 = y0 + 1;
+    if (x0 < 0) {
+        x0 = level.width - 1;
+    }
+    if (x1 >= level.width) {
+        x1 = 0;
+    }
+    if (y0 < 0) {
+        y0 = level.height - 1;
+    }
+    if (y1 >= level.height) {
+        y1 = 0;
+    }
+    const Vector3f &t00 = level.texels[level.index(x0, y0)];
+    const Vector3f &t10 = level.texels[level.index(x1, y0)];
+    const Vector3f &t01 = level.texels[level.index(x0, y1)];
+    const Vector3f &t11 = level.texels[level.index(x1, y1)];
+    Vector3f bottom = t00 + fx * (t10 - t00);
+    Vector3f top = t01 + fx * (t11 - t01);
+    return bottom + fy * (top - bottom);
+}
+
+Vector3f sample_texture(const Texture &texture, Real u, Real v, Real lod, TextureFilter filter) {
+    const int last = (int)texture.levels.size() - 1;
+    // The negated comparison also catches NaNs, e.g. from degenerate derivatives
+    if (!(lod > 0)) {
+        return sample_bilinear(texture.levels[0], u, v);
+    }
+    if (lod >= last) {
+        return sample_bilinear(texture.levels[last], u, v);
+    }
+    if (filter == TextureFilter::Bilinear) {
+        return sample_bilinear(texture.levels[int(lod + Real(0.5))], u, v);
+    }
+    int level = int(lod);
+    float t = float(lod - level);
+    Vector3f fine = sample_bilinear(texture.levels[level], u, v);
+    Vector3f coarse = sample_bilinear(texture.levels[level + 1], u, v);
+    return fine + t * (coarse - fine);
+}
+
+} // namespace hw2
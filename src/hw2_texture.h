@@ -0,0 +1,57 @@
+#pragma once
+
+#include "balboa.h"
+#include "image.h"
+#include "vector.h"
+#include <vector>
+
+namespace hw2 {
+
+/// How a texture is filtered between its texels and its mip levels.
+enum class TextureFilter {
+    Bilinear, // the four nearest texels of the nearest mip level
+    Trilinear // bilinear in the two mip levels around the footprint, blended
+};
+
+/// Texels are stored in square tiles of 1 << TEXTURE_TILE_BITS texels per
+/// side, the tiles row by row and the texels of a tile in Morton order, so
+/// the 2x2 footprint of a bilinear lookup mostly lies within a few cache lines.
+constexpr int TEXTURE_TILE_BITS = 2;
+constexpr int TEXTURE_TILE_SIZE = 1 << TEXTURE_TILE_BITS;
+
+/// One level of a mip pyramid, in the tiled layout.
+struct MipLevel {
+    int width, height;
+    int tiles_x; // tiles per row
+    std::vector<Vector3f> texels;
+
+    /// Index of texel (x, y) within texels.
+    int64_t index(int x, int y) const {
+        static_assert(TEXTURE_TILE_BITS == 2, "the Morton code below interleaves two bits per axis");
+        int morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+        return (int64_t(y >> TEXTURE_TILE_BITS) * tiles_x + (x >> TEXTURE_TILE_BITS)) *
+                   (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE) + morton;
+    }
+};
+
+/// An RGB texture with its mip pyramid, from the full image down to 1x1.
+/// Texture coordinates wrap around, and v = 0 is the bottom row of the image,
+/// as in OpenGL.
+struct Texture {
+    std::vector<MipLevel> levels;
+};
+
+/// Build the mip pyramid of an image, every level the 2x2 box filter of the one above.
+Texture make_texture(const Image3 &img);
+
+/// Load an image through imread3 and build its mip pyramid.
+Texture load_texture(const fs::path &filename);
+
+/// The mip level whose texels match a footprint: log2 of the longest
+/// screen-space derivative of (u, v), measured in texels of the full image.
+Real mip_level(const Texture &texture, Real dudx, Real dvdx, Real dudy, Real dvdy);
+
+/// Look up a texture at (u, v) with a footprint of mip level lod.
+Vector3f sample_texture(const Texture &texture, Real u, Real v, Real lod, TextureFilter filter);
+
+} // namespace hw2
@@ -6,6 +6,7 @@
 #include "hw3_scenes.h"
 #include "MyCamera.h"
 #include "Shader.h"
+#include <cstddef>
 #include <iostream>
 #include <filesystem>
 
@@ -123,6 +124,68 @@ glm::mat4 convertToGLMmat4(const Matrix4x4f& m) {
     return glmMatrix;
 }
 
+/**
+ * @brief Per-instance attributes of a draw, as read by the vertex shaders
+ */
+struct InstanceAttributes {
+    glm::mat4 model_matrix; // locations 3 to 6, one column each
+    glm::vec4 color; // location 7, replaces the vertex colors where alpha is 1
+    glm::mat3 normal_matrix; // locations 8 to 10, the inverse transpose of the model matrix
+};
+
+/**
+ * @brief Per-instance attributes of a transform and an optional color
+ * @param model_matrix Model matrix
+ * @param color Color replacing the vertex colors, if any
+ * @return Attributes of the instance
+ */
+InstanceAttributes makeInstanceAttributes(const Matrix4x4f &model_matrix, const std::optional<Vector3f> &color) {
+    InstanceAttributes instance;
+    instance.model_matrix = convertToGLMmat4(model_matrix);
+    instance.color = color ? glm::vec4(color->x, color->y, color->z, 1.0f) : glm::vec4(0.0f);
+    instance.normal_matrix = glm::transpose(glm::inverse(glm::mat3(instance.model_matrix)));
+    return instance;
+}
+
+/**
+ * @brief Upload the instances of a mesh into the bound vertex array, so that a
+ * single instanced draw covers all of them. A mesh without instances is drawn
+ * once with its own model matrix.
+ * @param mesh Mesh
+ * @return Number of instances to draw
+ */
+GLsizei setupInstanceAttributes(const TriangleMesh &mesh) {
+    std::vector<InstanceAttributes> instances;
+    if (mesh.instances.empty()) {
+        instances.push_back(makeInstanceAttributes(mesh.model_matrix, std::nullopt));
+    }
+    for (const MeshInstance &instance : mesh.instances) {
+        instances.push_back(makeInstanceAttributes(instance.model_matrix, instance.color));
+    }
+
+    unsigned int VBO_instance;
+    glGenBuffers(1, &VBO_instance);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_instance);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceAttributes), instances.data(), GL_STATIC_DRAW);
+    for (int col = 0; col < 4; col++) {
+        glVertexAttribPointer(3 + col, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAttributes),
+                              (void*)(offsetof(InstanceAttributes, model_matrix) + col * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + col);
+        glVertexAttribDivisor(3 + col, 1);
+    }
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAttributes),
+                          (void*)offsetof(InstanceAttributes, color));
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
+    for (int col = 0; col < 3; col++) {
+        glVertexAttribPointer(8 + col, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceAttributes),
+                              (void*)(offsetof(InstanceAttributes, normal_matrix) + col * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(8 + col);
+        glVertexAttribDivisor(8 + col, 1);
+    }
+    return (GLsizei)instances.size();
+}
+
 /**
  * @brief Callback function for mouse movement
  * @param window GLFW window
@@ -358,6 +421,7 @@ void hw_3_3(const std::vector<std::string> &params) {
     Shader ourShader("../src/hw_3_3.vs", "../src/hw_3_3.fs");
 
     std::vector<GLuint> VAOs;
+    std::vector<GLsizei> instanceCounts;
     for (auto &mesh : scene.meshes) {
         unsigned int VAO, VBO_vertex, VBO_color, EBO;
         glGenVertexArrays(1, &VAO);
@@ -379,6 +443,8 @@ void hw_3_3(const std::vector<std::string> &params) {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.faces.size() * sizeof(Vector3i), mesh.faces.data(), GL_STATIC_DRAW);
 
+        instanceCounts.push_back(setupInstanceAttributes(mesh));
+
         glBindVertexArray(0);
 
         VAOs.push_back(VAO);
@@ -421,13 +487,11 @@ void hw_3_3(const std::vector<std::string> &params) {
         glm::mat4 view_matrix = camera->GetViewMatrix();  // Get the view matrix from MyCamera
         ourShader.setMat4("view_matrix", view_matrix);
 
-        // Render each mesh
+        // Render each mesh, with all its instances in one draw
         for (int i = 0; i < scene.meshes.size(); i++) {
-            glm::mat4 model_matrix = convertToGLMmat4(scene.meshes[i].model_matrix);
-            ourShader.setMat4("model_matrix", model_matrix);
             glBindVertexArray(VAOs[i]);
-//            glDrawArrays(GL_TRIANGLES, 0, scene.meshes[i].vertices.size());
-            glDrawElements(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0);
+            glDrawElementsInstanced(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0,
+                                    instanceCounts[i]);
 
         }
         glfwSwapBuffers(window);
@@ -501,6 +565,7 @@ void hw_3_4(const std::vector<std::string> &params) {
     Shader ourShader("../src/hw_3_4.vs", "../src/hw_3_4.fs");
 
     std::vector<GLuint> VAOs;
+    std::vector<GLsizei> instanceCounts;
     for (auto &mesh : scene.meshes) {
         unsigned int VAO, VBO_vertex, VBO_color, VBO_normal, EBO;
         glGenVertexArrays(1, &VAO);
@@ -528,6 +593,8 @@ void hw_3_4(const std::vector<std::string> &params) {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.faces.size() * sizeof(Vector3i), mesh.faces.data(), GL_STATIC_DRAW);
 
+        instanceCounts.push_back(setupInstanceAttributes(mesh));
+
         glBindVertexArray(0);
 
         VAOs.push_back(VAO);
@@ -589,12 +656,11 @@ void hw_3_4(const std::vector<std::string> &params) {
             ourShader.setVec3("lightPos", lightX, lightY, lightZ);
         }
 
-        // Render each mesh
+        // Render each mesh, with all its instances in one draw
         for (int i = 0; i < scene.meshes.size(); i++) {
-            glm::mat4 model_matrix = convertToGLMmat4(scene.meshes[i].model_matrix);
-            ourShader.setMat4("model_matrix", model_matrix);
             glBindVertexArray(VAOs[i]);
-            glDrawElements(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0);
+            glDrawElementsInstanced(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0,
+                                    instanceCounts[i]);
         }
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -678,6 +744,7 @@ void hw_3_3_extra(const std::vector<std::string> &params) {
     ourShader.setInt("ourTexture", 0);
 
     std::vector<GLuint> VAOs;
+    std::vector<GLsizei> instanceCounts;
     for (auto &mesh : scene.meshes) {
         unsigned int VAO, VBO_vertex, VBO_color, EBO;
         glGenVertexArrays(1, &VAO);
@@ -708,6 +775,8 @@ void hw_3_3_extra(const std::vector<std::string> &params) {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.faces.size() * sizeof(Vector3i), mesh.faces.data(), GL_STATIC_DRAW);
 
+        instanceCounts.push_back(setupInstanceAttributes(mesh));
+
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, mesh.uvs.data());
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -760,13 +829,11 @@ void hw_3_3_extra(const std::vector<std::string> &params) {
         glm::mat4 view_matrix = camera->GetViewMatrix();  // Get the view matrix from MyCamera
         ourShader.setMat4("view_matrix", view_matrix);
 
-        // Render each mesh
+        // Render each mesh, with all its instances in one draw
         for (int i = 0; i < scene.meshes.size(); i++) {
-            glm::mat4 model_matrix = convertToGLMmat4(scene.meshes[i].model_matrix);
-            ourShader.setMat4("model_matrix", model_matrix);
             glBindVertexArray(VAOs[i]);
-//            glDrawArrays(GL_TRIANGLES, 0, scene.meshes[i].vertices.size());
-            glDrawElements(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0);
+            glDrawElementsInstanced(GL_TRIANGLES, scene.meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0,
+                                    instanceCounts[i]);
 
         }
         glfwSwapBuffers(window);
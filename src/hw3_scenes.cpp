@@ -170,17 +170,11 @@ TriangleMesh parse_ply(const fs::path &filename) {
 }
 
 
-    Matrix4x4 parse_transformation(const json &node) {
+    Matrix4x4 parse_transform_list(const json &transform) {
         // Homework 2.4: parse a sequence of linear transformation and
         // combine them into a 4x4 transformation matrix
         Matrix4x4 F = Matrix4x4::identity();
-        auto transform_it = node.find("transform");
-        if (transform_it == node.end()) {
-            // Transformation not specified, return identity.
-            return F;
-        }
-
-        for (auto it = transform_it->begin(); it != transform_it->end(); it++) {
+        for (auto it = transform.begin(); it != transform.end(); it++) {
             if (auto scale_it = it->find("scale"); scale_it != it->end()) {
                 Vector3 scale = Vector3{
                         (*scale_it)[0], (*scale_it)[1], (*scale_it)[2]
@@ -256,6 +250,15 @@ TriangleMesh parse_ply(const fs::path &filename) {
         return F;
     }
 
+    Matrix4x4 parse_transformation(const json &node) {
+        auto transform_it = node.find("transform");
+        if (transform_it == node.end()) {
+            // Transformation not specified, return identity.
+            return Matrix4x4::identity();
+        }
+        return parse_transform_list(*transform_it);
+    }
+
 Scene parse_scene(const fs::path &filename) {
     std::ifstream f(filename.string().c_str());
     json data = json::parse(f);
@@ -300,14 +303,14 @@ Scene parse_scene(const fs::path &filename) {
         };
     }
 
-    auto objects = data.find("objects");
-    for (auto it = objects->begin(); it != objects->end(); it++) {
+    // Load the mesh of an object or of an instances block, without its transform
+    auto parse_mesh = [&](const json &node) {
         TriangleMesh mesh;
-        if (auto fn_it = it->find("filename"); fn_it != it->end()) {
+        if (auto fn_it = node.find("filename"); fn_it != node.end()) {
             mesh = parse_ply(std::string(*fn_it));
         } else {
-            auto vertices_it = it->find("vertices");
-            if (vertices_it != it->end()) {
+            auto vertices_it = node.find("vertices");
+            if (vertices_it != node.end()) {
                 int num_vertices = vertices_it->size() / 3;
                 mesh.vertices.resize(num_vertices);
                 for (int i = 0; i < num_vertices; i++) {
@@ -318,8 +321,8 @@ Scene parse_scene(const fs::path &filename) {
                     };
                 }
             }
-            auto faces_it = it->find("faces");
-            if (faces_it != it->end()) {
+            auto faces_it = node.find("faces");
+            if (faces_it != node.end()) {
                 int num_triangles = faces_it->size() / 3;
                 mesh.faces.resize(num_triangles);
                 for (int i = 0; i < num_triangles; i++) {
@@ -330,13 +333,13 @@ Scene parse_scene(const fs::path &filename) {
                     };
                 }
             }
-            auto vertex_colors_it = it->find("vertex_colors");
-            if (vertex_colors_it != it->end()) {
+            auto vertex_colors_it = node.find("vertex_colors");
+            if (vertex_colors_it != node.end()) {
                 int num_vertices = vertex_colors_it->size() / 3;
                 mesh.vertex_colors.resize(num_vertices);
                 if (mesh.vertex_colors.size() != mesh.vertices.size()) {
                     Error("Mesh has different number of vertices and number of colors.");
-                    return scene;
+                    return mesh;
                 }
                 for (int i = 0; i < num_vertices; i++) {
                     mesh.vertex_colors[i] = Vector3f{
@@ -348,8 +351,52 @@ Scene parse_scene(const fs::path &filename) {
             }
         }
         
-        mesh.model_matrix = parse_transformation(*it);
-        scene.meshes.push_back(mesh);
+        // Reorder the faces and vertices for cache locality if the scene asks for it ("reorder": true);
+        // the file order is kept by default, since the order of faces at equal depth shows in the image
+        mesh.file_order_caches = simulate_mesh_caches(mesh.faces, sizeof(Vector3f));
+        if (auto reorder_it = node.find("reorder"); reorder_it != node.end() && *reorder_it) {
+            MeshOrder order = optimize_mesh_order(mesh.vertices, mesh.faces);
+            mesh.vertex_colors = permuted(mesh.vertex_colors, order.vertices);
+            mesh.uvs = permuted(mesh.uvs, order.vertices);
+            mesh.vertex_normals = permuted(mesh.vertex_normals, order.vertices);
+        }
+        mesh.caches = simulate_mesh_caches(mesh.faces, sizeof(Vector3f));
+        return mesh;
+    };
+
+    if (auto objects = data.find("objects"); objects != data.end()) {
+        for (auto it = objects->begin(); it != objects->end(); it++) {
+            TriangleMesh mesh = parse_mesh(*it);
+            mesh.model_matrix = parse_transformation(*it);
+            scene.meshes.push_back(std::move(mesh));
+        }
+    }
+    // An instances block loads its mesh once and draws it with every one of
+    // its transforms, and optionally a color per transform
+    if (auto instances = data.find("instances"); instances != data.end()) {
+        for (auto it = instances->begin(); it != instances->end(); it++) {
+            TriangleMesh mesh = parse_mesh(*it);
+            mesh.model_matrix = Matrix4x4::identity();
+            auto transforms_it = it->find("transforms");
+            if (transforms_it == it->end()) {
+                Error("Instances do not contain the field \"transforms\".");
+                return scene;
+            }
+            auto colors_it = it->find("colors");
+            if (colors_it != it->end() && colors_it->size() != transforms_it->size()) {
+                Error("Instances have different number of transforms and colors.");
+                return scene;
+            }
+            mesh.instances.resize(transforms_it->size());
+            for (int i = 0; i < (int)mesh.instances.size(); i++) {
+                mesh.instances[i].model_matrix = parse_transform_list((*transforms_it)[i]);
+                if (colors_it != it->end()) {
+                    const json &color = (*colors_it)[i];
+                    mesh.instances[i].color = Vector3f{color[0], color[1], color[2]};
+                }
+            }
+            scene.meshes.push_back(std::move(mesh));
+        }
     }
 
     // switch back to the old current working directory
@@ -372,7 +419,12 @@ std::ostream& operator<<(std::ostream &os, const TriangleMesh &mesh) {
     os << "TriangleMesh[" << std::endl;
     os << "\tnum_vertices=" << mesh.vertices.size() << std::endl;
     os << "\tnum_faces=" << mesh.faces.size() << std::endl;
+    os << "\tfile_order_caches=" << mesh.file_order_caches << std::endl;
+    os << "\tcaches=" << mesh.caches << std::endl;
     os << "\ttransform=" << std::endl << mesh.model_matrix << std::endl;
+    if (!mesh.instances.empty()) {
+        os << "\tnum_instances=" << mesh.instances.size() << std::endl;
+    }
     os << "]";
     return os;
 }
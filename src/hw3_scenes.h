@@ -2,11 +2,20 @@
 
 #include "balboa.h"
 #include "matrix.h"
+#include "mesh_order.h"
 #include "vector.h"
+#include <optional>
 #include <vector>
 
 namespace hw3 {
 
+/// One copy of a mesh of an "instances" block of a scene, drawn with its own
+/// transform. All the copies share the geometry of the mesh.
+struct MeshInstance {
+    Matrix4x4f model_matrix;
+    std::optional<Vector3f> color; // replaces the vertex colors of the mesh if set
+};
+
 struct TriangleMesh {
     std::vector<Vector3f> vertices; // 3D positions of the vertices
     std::vector<Vector3i> faces; // indices of the triangles
@@ -14,6 +23,10 @@ struct TriangleMesh {
     std::vector<Vector2f> uvs; // UV coordinates (for bonus)
     std::vector<Vector3f> vertex_normals; // vertex normals (for lighting in 3.4)
     Matrix4x4f model_matrix;
+    // if not empty, the mesh is drawn once per instance, in place of model_matrix
+    std::vector<MeshInstance> instances;
+    // vertex cache misses of the faces as loaded, and as drawn (reordered if the scene asks, see mesh_order.h)
+    MeshCacheStats file_order_caches, caches;
 };
 
 struct Camera {
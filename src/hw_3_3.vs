@@ -1,7 +1,8 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 Colors;
-uniform mat4 model_matrix;
+layout (location = 3) in mat4 model_matrix; // per instance
+layout (location = 7) in vec4 instance_color; // replaces the vertex colors where alpha is 1
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 out vec3 ColorsVector;
@@ -9,5 +10,5 @@ out vec3 ColorsVector;
 void main()
 {
     gl_Position = projection_matrix * view_matrix * model_matrix * vec4(aPos, 1.0);
-    ColorsVector = Colors;
+    ColorsVector = mix(Colors, instance_color.rgb, instance_color.a);
 }
@@ -3,7 +3,8 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 Colors;
 layout (location = 2) in vec2 aTexCoord; // Texture coordinate attribute
 
-uniform mat4 model_matrix;
+layout (location = 3) in mat4 model_matrix; // per instance
+layout (location = 7) in vec4 instance_color; // replaces the vertex colors where alpha is 1
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 out vec3 ColorsVector;
@@ -12,6 +13,6 @@ out vec2 TexCoord;  // Pass texture coordinates to fragment shader
 void main()
 {
     gl_Position = projection_matrix * view_matrix * model_matrix * vec4(aPos, 1.0);
-    ColorsVector = Colors;
+    ColorsVector = mix(Colors, instance_color.rgb, instance_color.a);
     TexCoord = aTexCoord;
 }
@@ -2,7 +2,9 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 Colors;
 layout (location = 2) in vec3 aNormal;
-uniform mat4 model_matrix;
+layout (location = 3) in mat4 model_matrix; // per instance
+layout (location = 7) in vec4 instance_color; // replaces the vertex colors where alpha is 1
+layout (location = 8) in mat3 normal_matrix; // per instance, the inverse transpose of model_matrix
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 out vec3 ColorsVector;
@@ -11,7 +13,7 @@ out vec3 FragPos;
 
 void main() {
     gl_Position = projection_matrix * view_matrix * model_matrix * vec4(aPos, 1.0);
-    ColorsVector = Colors;
-    NormalVector = mat3(transpose(inverse(model_matrix))) * aNormal;
+    ColorsVector = mix(Colors, instance_color.rgb, instance_color.a);
+    NormalVector = normal_matrix * aNormal;
     FragPos = vec3(model_matrix * vec4(aPos, 1.0));
 }
@@ -0,0 +1,148 @@
+#include "mesh_order.h"
+#include <numeric>
+
+/**
+ * Spread the low 10 bits of an integer out to every third bit
+ * @param x The integer
+ * @return Bit i of x moved to bit 3 * i
+ */
+static uint32_t spread_bits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+/**
+ * The order of the faces along a Morton curve through their centroids,
+ * quantized to 10 bits per axis within the bounding box of the centroids
+ * @param vertices The vertex positions
+ * @param faces The faces
+ * @return The old index of every face in the new order; ties keep the old order
+ */
+template <typename T>
+static std::vector<int> morton_face_order(const std::vector<TVector3<T>> &vertices,
+                                          const std::vector<Vector3i> &faces) {
+    std::vector<TVector3<T>> centroids(faces.size());
+    TVector3<T> p_min{std::numeric_limits<T>::infinity(), std::numeric_limits<T>::infinity(),
+                      std::numeric_limits<T>::infinity()};
+    TVector3<T> p_max = -p_min;
+    for (int f = 0; f < (int)faces.size(); f++) {
+        centroids[f] = (vertices[faces[f][0]] + vertices[faces[f][1]] + vertices[faces[f][2]]) / T(3);
+        for (int a = 0; a < 3; a++) {
+            p_min[a] = min(p_min[a], centroids[f][a]);
+            p_max[a] = max(p_max[a], centroids[f][a]);
+        }
+    }
+
+    std::vector<uint32_t> codes(faces.size());
+    for (int f = 0; f < (int)faces.size(); f++) {
+        uint32_t code = 0;
+        for (int a = 0; a < 3; a++) {
+            T extent = p_max[a] - p_min[a];
+            uint32_t cell = extent > 0 ? uint32_t(min(T(1023), (centroids[f][a] - p_min[a]) / extent * T(1024))) : 0;
+            code |= spread_bits(cell) << a;
+        }
+        codes[f] = code;
+    }
+    std::vector<int> order(faces.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return codes[a] < codes[b]; });
+    return order;
+}
+
+/**
+ * The order in which the faces first use the vertices
+ * @param faces The faces, in their new order
+ * @param num_vertices The number of vertices
+ * @return The old index of every vertex in the new order; unused vertices go last
+ */
+static std::vector<int> first_use_vertex_order(const std::vector<Vector3i> &faces, int num_vertices) {
+    std::vector<uint8_t> used(num_vertices, 0);
+    std::vector<int> order;
+    order.reserve(num_vertices);
+    for (const Vector3i &face : faces) {
+        for (int i = 0; i < 3; i++) {
+            if (!used[face[i]]) {
+                used[face[i]] = 1;
+                order.push_back(face[i]);
+            }
+        }
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        if (!used[v]) {
+            order.push_back(v);
+        }
+    }
+    return order;
+}
+
+template <typename T>
+MeshOrder optimize_mesh_order(std::vector<TVector3<T>> &vertices, std::vector<Vector3i> &faces) {
+    MeshOrder order;
+    order.faces = morton_face_order(vertices, faces);
+    faces = permuted(faces, order.faces);
+    order.vertices = first_use_vertex_order(faces, (int)vertices.size());
+    vertices = permuted(vertices, order.vertices);
+
+    std::vector<int> new_index(order.vertices.size());
+    for (int k = 0; k < (int)order.vertices.size(); k++) {
+        new_index[order.vertices[k]] = k;
+    }
+    for (Vector3i &face : faces) {
+        face = Vector3i{new_index[face[0]], new_index[face[1]], new_index[face[2]]};
+    }
+    return order;
+}
+
+template MeshOrder optimize_mesh_order(std::vector<TVector3<float>> &vertices, std::vector<Vector3i> &faces);
+template MeshOrder optimize_mesh_order(std::vector<TVector3<double>> &vertices, std::vector<Vector3i> &faces);
+
+MeshCacheStats simulate_mesh_caches(const std::vector<Vector3i> &faces, int vertex_bytes) {
+    const int64_t FIFO_SIZE = 32;
+    const int LINE_BYTES = 64, NUM_LINES = 512;
+    MeshCacheStats stats;
+    if (faces.empty()) {
+        return stats;
+    }
+    int num_vertices = 0;
+    for (const Vector3i &face : faces) {
+        num_vertices = max(num_vertices, max(face[0], max(face[1], face[2])) + 1);
+    }
+
+    // A vertex is in the FIFO until FIFO_SIZE others have entered after it;
+    // hits do not move it.
+    std::vector<int64_t> entered(num_vertices, -FIFO_SIZE);
+    int64_t entries = 0, transform_misses = 0;
+    std::vector<int64_t> lines(NUM_LINES, -1);
+    int64_t fetch_misses = 0;
+    for (const Vector3i &face : faces) {
+        for (int i = 0; i < 3; i++) {
+            const int v = face[i];
+            if (entries - entered[v] < FIFO_SIZE) {
+                continue;
+            }
+            entered[v] = entries++;
+            transform_misses++;
+            // Only transformed vertices are fetched
+            int64_t first = int64_t(v) * vertex_bytes / LINE_BYTES;
+            int64_t last = (int64_t(v) * vertex_bytes + vertex_bytes - 1) / LINE_BYTES;
+            for (int64_t line = first; line <= last; line++) {
+                if (lines[line % NUM_LINES] != line) {
+                    lines[line % NUM_LINES] = line;
+                    fetch_misses++;
+                }
+            }
+        }
+    }
+    stats.transform_misses = Real(transform_misses) / Real(faces.size());
+    stats.fetch_misses = Real(fetch_misses) / Real(faces.size());
+    return stats;
+}
+
+std::ostream& operator<<(std::ostream &os, const MeshCacheStats &stats) {
+    return os << "MeshCacheStats[transform_misses=" << stats.transform_misses <<
+                 ", fetch_misses=" << stats.fetch_misses << "]";
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "balboa.h"
+#include "vector.h"
+#include <vector>
+
+/// Load-time reordering of triangle meshes for cache locality, shared by the
+/// software rasterizer of hw2 and the OpenGL viewer of hw3.
+/// The faces are sorted along a Morton curve through their centroids, so
+/// consecutive faces lie close together and reuse vertices and screen tiles.
+/// The vertices are then renumbered in the order the faces first use them,
+/// so fetching them walks the vertex arrays forwards.
+/// It is opt-in per mesh ("reorder": true in the scene), because faces drawn
+/// in a different order can resolve depth ties and blending differently.
+
+/// How well the index order of a mesh uses the vertex caches, in misses per triangle.
+struct MeshCacheStats {
+    Real transform_misses = 0; // of a 32-entry FIFO of transformed vertices (the ACMR)
+    Real fetch_misses = 0; // of 64-byte lines of vertex data in a 32 KB direct-mapped cache
+};
+
+/// A new order of the faces and vertices of a mesh: faces[k] is the old
+/// index of the k-th face and vertices[k] the old index of the k-th vertex.
+struct MeshOrder {
+    std::vector<int> faces;
+    std::vector<int> vertices;
+};
+
+/// Reorder the faces of a mesh by the Morton codes of their centroids, then
+/// its vertices by first use, remapping the indices of the faces.
+/// Returns the orders, to apply to the other per-face and per-vertex arrays
+/// with permuted().
+template <typename T>
+MeshOrder optimize_mesh_order(std::vector<TVector3<T>> &vertices, std::vector<Vector3i> &faces);
+
+/// Simulate the vertex caches over the indices of the faces, in face order.
+/// vertex_bytes is the size of the data fetched per vertex.
+MeshCacheStats simulate_mesh_caches(const std::vector<Vector3i> &faces, int vertex_bytes);
+
+/// Gather values into a new order: result[k] = values[order[k]].
+/// Empty arrays (attributes a mesh does not have) stay empty.
+template <typename T>
+std::vector<T> permuted(const std::vector<T> &values, const std::vector<int> &order) {
+    if (values.empty()) {
+        return values;
+    }
+    std::vector<T> result(order.size());
+    for (int k = 0; k < (int)order.size(); k++) {
+        result[k] = values[order[k]];
+    }
+    return result;
+}
+
+std::ostream& operator<<(std::ostream &os, const MeshCacheStats &stats);
@@ -0,0 +1,62 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+int num_system_cores() {
+    int cores = int(std::thread::hardware_concurrency());
+    return cores > 0 ? cores : 1;
+}
+
+void parallel_for(const std::function<void(int64_t)> &func,
+                  int64_t count,
+                  int num_threads,
+                  int64_t chunk_size) {
+    parallel_for([&](int64_t i, int /*worker*/) { func(i); }, count, num_threads, chunk_size);
+}
+
+void parallel_for(const std::function<void(int64_t, int)> &func,
+                  int64_t count,
+                  int num_threads,
+                  int64_t chunk_size) {
+    if (count <= 0) {
+        return;
+    }
+    if (num_threads <= 0) {
+        num_threads = num_system_cores();
+    }
+    chunk_size = max(chunk_size, int64_t(1));
+    int64_t num_chunks = (count + chunk_size - 1) / chunk_size;
+    num_threads = int(min(int64_t(num_threads), num_chunks));
+
+    std::atomic<int64_t> next_chunk(0);
+    auto worker = [&](int worker_id) {
+        for (;;) {
+            int64_t chunk = next_chunk.fetch_add(1);
+            if (chunk >= num_chunks) {
+                break;
+            }
+            int64_t begin = chunk * chunk_size;
+            int64_t end = min(begin + chunk_size, count);
+            for (int64_t i = begin; i < end; i++) {
+                func(i, worker_id);
+            }
+        }
+    };
+
+    if (num_threads == 1) {
+        worker(0);
+        return;
+    }
+    // The calling thread works too, so only spawn num_threads - 1 helpers.
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (int i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &t : threads) {
+        t.join();
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "balboa.h"
+
+#include <functional>
+
+/// Number of hardware threads reported by the system (at least 1).
+int num_system_cores();
+
+/// Run func(i) for every i in [0, count) on a pool of worker threads.
+/// Work is handed out dynamically in chunks of chunk_size indices,
+/// so items of uneven cost still balance across the threads.
+/// num_threads <= 0 uses all cores; num_threads == 1 runs on the calling thread.
+void parallel_for(const std::function<void(int64_t)> &func,
+                  int64_t count,
+                  int num_threads = 0,
+                  int64_t chunk_size = 1);
+
+/// Same as above, but call func(i, worker) where worker in [0, num_threads)
+/// identifies the thread running it, so callers can keep per-thread scratch data.
+void parallel_for(const std::function<void(int64_t, int)> &func,
+                  int64_t count,
+                  int num_threads = 0,
+                  int64_t chunk_size = 1);
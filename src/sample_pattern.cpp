@@ -0,0 +1,104 @@
+#include "sample_pattern.h"
+#include "flexception.h"
+
+SamplePattern parse_sample_pattern(const std::string &name) {
+    std::string pattern = to_lowercase(name);
+    if (pattern == "grid") {
+        return SamplePattern::Grid;
+    } else if (pattern == "rotated_grid") {
+        return SamplePattern::RotatedGrid;
+    } else if (pattern == "low_discrepancy") {
+        return SamplePattern::LowDiscrepancy;
+    }
+    Error("Unknown sample pattern " + name + " (expected grid, rotated_grid or low_discrepancy).");
+    return SamplePattern::Grid;
+}
+
+std::ostream& operator<<(std::ostream &os, SamplePattern pattern) {
+    switch (pattern) {
+        case SamplePattern::Grid: return os << "grid";
+        case SamplePattern::RotatedGrid: return os << "rotated_grid";
+        case SamplePattern::LowDiscrepancy: return os << "low_discrepancy";
+    }
+    return os;
+}
+
+void parse_anti_aliasing_flags(const std::vector<std::string> &params, AntiAliasing &anti_aliasing) {
+    for (int i = 0; i < (int)params.size(); i++) {
+        if (params[i] == "-aa") {
+            anti_aliasing.aa_factor = std::stoi(params[++i]);
+        } else if (params[i] == "-sample_pattern") {
+            anti_aliasing.pattern = parse_sample_pattern(params[++i]);
+        }
+    }
+}
+
+/**
+ * Reverse the bits of a 32-bit integer, the van der Corput sequence in base 2
+ * @param k The index
+ * @return The k-th point of the sequence in 0.32 fixed point
+ */
+static uint32_t van_der_corput(uint32_t k) {
+    uint32_t r = 0;
+    for (int bit = 0; bit < 32; bit++, k >>= 1) {
+        r = (r << 1) | (k & 1);
+    }
+    return r;
+}
+
+/**
+ * The second dimension of the Sobol sequence
+ * @param k The index
+ * @return The k-th point of the sequence in 0.32 fixed point
+ */
+static uint32_t sobol_2(uint32_t k) {
+    uint32_t r = 0;
+    for (uint32_t v = uint32_t(1) << 31; k != 0; k >>= 1, v ^= v >> 1) {
+        if (k & 1) {
+            r ^= v;
+        }
+    }
+    return r;
+}
+
+std::vector<Vector2> sample_positions(const AntiAliasing &anti_aliasing) {
+    const int n = anti_aliasing.aa_factor;
+    if (n < 1) {
+        Error("The anti-aliasing factor must be at least 1.");
+    }
+    const int count = n * n;
+    std::vector<Vector2> positions(count);
+    switch (anti_aliasing.pattern) {
+        case SamplePattern::Grid:
+            for (int j = 0; j < n; j++) {
+                for (int i = 0; i < n; i++) {
+                    positions[j * n + i] = Vector2{(i + Real(0.5)) / n, (j + Real(0.5)) / n};
+                }
+            }
+            break;
+        case SamplePattern::RotatedGrid:
+            // Cell (i, j) steps by (n, -1) and (1, n) on the n^2 x n^2 grid
+            for (int j = 0; j < n; j++) {
+                for (int i = 0; i < n; i++) {
+                    positions[j * n + i] = Vector2{(i * n + j + Real(0.5)) / count,
+                                                   (j * n + (n - 1 - i) + Real(0.5)) / count};
+                }
+            }
+            break;
+        case SamplePattern::LowDiscrepancy: {
+            if ((n & (n - 1)) != 0) {
+                Error("The low-discrepancy pattern needs a power of two anti-aliasing factor.");
+            }
+            // The first n^2 Sobol points form a (0, 2)-net: one point in each
+            // cell, all on distinct multiples of 1 / n^2 in x and in y.
+            for (int k = 0; k < count; k++) {
+                Real x = (van_der_corput(k) / Real(4294967296.0)) + Real(0.5) / count;
+                Real y = (sobol_2(k) / Real(4294967296.0)) + Real(0.5) / count;
+                int i = int(x * n), j = int(y * n);
+                positions[j * n + i] = Vector2{x, y};
+            }
+            break;
+        }
+    }
+    return positions;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "balboa.h"
+#include "vector.h"
+#include <string>
+#include <vector>
+
+/// Where the samples of a pixel lie. Every pattern splits the pixel into an
+/// n x n grid of cells and puts exactly one sample in each cell, so all of
+/// them stratify like the regular grid and only differ within the cells.
+enum class SamplePattern {
+    Grid, // the cell centers
+    RotatedGrid, // the grid rotated by atan(1/n): no two samples share a row or a column
+    LowDiscrepancy // the first n^2 points of the 2D Sobol sequence, n a power of two
+};
+
+/// Anti-aliasing settings shared by the renderers of every homework.
+struct AntiAliasing {
+    int aa_factor = 4; // samples per pixel along each axis, n
+    SamplePattern pattern = SamplePattern::Grid;
+};
+
+/// Parse a pattern name (grid, rotated_grid or low_discrepancy).
+SamplePattern parse_sample_pattern(const std::string &name);
+
+std::ostream& operator<<(std::ostream &os, SamplePattern pattern);
+
+/// Override anti-aliasing settings with the -aa and -sample_pattern flags
+/// in a parameter list. Other parameters are ignored.
+void parse_anti_aliasing_flags(const std::vector<std::string> &params, AntiAliasing &anti_aliasing);
+
+/// The sample positions within a pixel, in [0, 1) x [0, 1).
+/// Position j * n + i lies in cell (i, j) of the n x n grid.
+std::vector<Vector2> sample_positions(const AntiAliasing &anti_aliasing);
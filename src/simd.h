@@ -0,0 +1,639 @@
+#pragma once
+
+// Minimal 8-lane SIMD packs for the software rasterizer kernels.
+//
+// The same kernel source is compiled more than once with different
+// instruction sets (see hw2_raster_avx2.cpp). Everything here lives in a
+// namespace named after the instruction set the including file is compiled
+// for, so the inline functions of the different builds never collide when
+// the linker merges them.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#define SIMD_NAMESPACE simd_avx2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE
+#define SIMD_NAMESPACE simd_sse
+#else
+#define SIMD_NAMESPACE simd_scalar
+#endif
+
+namespace SIMD_NAMESPACE {
+
+/// 8 doubles. Comparisons return a pack with all bits set in the true lanes.
+struct Double8 {
+#if defined(SIMD_AVX2)
+    __m256d v[2];
+#elif defined(SIMD_SSE)
+    __m128d v[4];
+#else
+    double v[8];
+#endif
+
+    static Double8 set1(double x);
+    /// (0, 1, ..., 7)
+    static Double8 lane_index();
+};
+
+/// 8 floats, half the registers of a Double8.
+struct Float8 {
+#if defined(SIMD_AVX2)
+    __m256 v;
+#elif defined(SIMD_SSE)
+    __m128 v[2];
+#else
+    float v[8];
+#endif
+
+    static Float8 set1(float x);
+    /// (0, 1, ..., 7)
+    static Float8 lane_index();
+};
+
+/// The 8-lane pack of a scalar type.
+template <typename T>
+struct Pack8;
+template <>
+struct Pack8<double> {
+    using type = Double8;
+};
+template <>
+struct Pack8<float> {
+    using type = Float8;
+};
+
+#if defined(SIMD_AVX2)
+
+inline Double8 Double8::set1(double x) {
+    return {{_mm256_set1_pd(x), _mm256_set1_pd(x)}};
+}
+inline Double8 Double8::lane_index() {
+    return {{_mm256_set_pd(3, 2, 1, 0), _mm256_set_pd(7, 6, 5, 4)}};
+}
+inline Double8 operator+(const Double8 &a, const Double8 &b) {
+    return {{_mm256_add_pd(a.v[0], b.v[0]), _mm256_add_pd(a.v[1], b.v[1])}};
+}
+inline Double8 operator*(const Double8 &a, const Double8 &b) {
+    return {{_mm256_mul_pd(a.v[0], b.v[0]), _mm256_mul_pd(a.v[1], b.v[1])}};
+}
+inline Double8 operator/(const Double8 &a, const Double8 &b) {
+    return {{_mm256_div_pd(a.v[0], b.v[0]), _mm256_div_pd(a.v[1], b.v[1])}};
+}
+inline Double8 operator&(const Double8 &a, const Double8 &b) {
+    return {{_mm256_and_pd(a.v[0], b.v[0]), _mm256_and_pd(a.v[1], b.v[1])}};
+}
+inline Double8 operator>=(const Double8 &a, const Double8 &b) {
+    return {{_mm256_cmp_pd(a.v[0], b.v[0], _CMP_GE_OQ), _mm256_cmp_pd(a.v[1], b.v[1], _CMP_GE_OQ)}};
+}
+inline Double8 operator>(const Double8 &a, const Double8 &b) {
+    return {{_mm256_cmp_pd(a.v[0], b.v[0], _CMP_GT_OQ), _mm256_cmp_pd(a.v[1], b.v[1], _CMP_GT_OQ)}};
+}
+/// One bit per lane, lane 0 in the lowest bit.
+inline int movemask(const Double8 &m) {
+    return _mm256_movemask_pd(m.v[0]) | (_mm256_movemask_pd(m.v[1]) << 4);
+}
+inline void store(double *p, const Double8 &a) {
+    _mm256_storeu_pd(p, a.v[0]);
+    _mm256_storeu_pd(p + 4, a.v[1]);
+}
+inline Double8 load(const double *p) {
+    return {{_mm256_loadu_pd(p), _mm256_loadu_pd(p + 4)}};
+}
+/// Load the lanes set in mask; the others read as zero and never touch memory.
+inline Double8 load_masked(const double *p, const Double8 &mask) {
+    return {{_mm256_maskload_pd(p, _mm256_castpd_si256(mask.v[0])),
+             _mm256_maskload_pd(p + 4, _mm256_castpd_si256(mask.v[1]))}};
+}
+/// Store the lanes set in mask and leave the others untouched in memory.
+inline void store_masked(double *p, const Double8 &mask, const Double8 &a) {
+    _mm256_maskstore_pd(p, _mm256_castpd_si256(mask.v[0]), a.v[0]);
+    _mm256_maskstore_pd(p + 4, _mm256_castpd_si256(mask.v[1]), a.v[1]);
+}
+
+inline Float8 Float8::set1(float x) {
+    return {_mm256_set1_ps(x)};
+}
+inline Float8 Float8::lane_index() {
+    return {_mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0)};
+}
+inline Float8 operator+(const Float8 &a, const Float8 &b) {
+    return {_mm256_add_ps(a.v, b.v)};
+}
+inline Float8 operator*(const Float8 &a, const Float8 &b) {
+    return {_mm256_mul_ps(a.v, b.v)};
+}
+inline Float8 operator/(const Float8 &a, const Float8 &b) {
+    return {_mm256_div_ps(a.v, b.v)};
+}
+inline Float8 operator&(const Float8 &a, const Float8 &b) {
+    return {_mm256_and_ps(a.v, b.v)};
+}
+inline Float8 operator>=(const Float8 &a, const Float8 &b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)};
+}
+inline Float8 operator>(const Float8 &a, const Float8 &b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};
+}
+inline int movemask(const Float8 &m) {
+    return _mm256_movemask_ps(m.v);
+}
+inline void store(float *p, const Float8 &a) {
+    _mm256_storeu_ps(p, a.v);
+}
+inline Float8 load(const float *p) {
+    return {_mm256_loadu_ps(p)};
+}
+inline Float8 load_masked(const float *p, const Float8 &mask) {
+    return {_mm256_maskload_ps(p, _mm256_castps_si256(mask.v))};
+}
+inline void store_masked(float *p, const Float8 &mask, const Float8 &a) {
+    _mm256_maskstore_ps(p, _mm256_castps_si256(mask.v), a.v);
+}
+/// Round to the nearest float. Signs and zeros are kept exactly.
+inline void convert(const Double8 &a, Float8 &out) {
+    out.v = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(a.v[0])),
+                                 _mm256_cvtpd_ps(a.v[1]), 1);
+}
+inline Float8 operator-(const Float8 &a, const Float8 &b) {
+    return {_mm256_sub_ps(a.v, b.v)};
+}
+inline Float8 min(const Float8 &a, const Float8 &b) {
+    return {_mm256_min_ps(a.v, b.v)};
+}
+inline Float8 max(const Float8 &a, const Float8 &b) {
+    return {_mm256_max_ps(a.v, b.v)};
+}
+/// a in the lanes of mask, b in the others.
+inline Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b) {
+    return {_mm256_blendv_ps(b.v, a.v, mask.v)};
+}
+/// About 12 bits of 1 / sqrt(a).
+inline Float8 rsqrt_estimate(const Float8 &a) {
+    return {_mm256_rsqrt_ps(a.v)};
+}
+inline Float8 floor(const Float8 &a) {
+    return {_mm256_floor_ps(a.v)};
+}
+/// Split a = mantissa * 2^exponent with the mantissa in [1, 2), for positive
+/// normal a; returns the exponent. Zero comes out as 2^-127.
+inline Float8 split_exponent(const Float8 &a, Float8 &mantissa) {
+    __m256i bits = _mm256_castps_si256(a.v);
+    mantissa.v = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                     _mm256_set1_epi32(0x3f800000)));
+    return {_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)))};
+}
+/// 2^n for integral n in [-126, 127].
+inline Float8 exp2_integer(const Float8 &n) {
+    __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+    return {_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))};
+}
+
+#elif defined(SIMD_SSE)
+
+inline Double8 Double8::set1(double x) {
+    __m128d s = _mm_set1_pd(x);
+    return {{s, s, s, s}};
+}
+inline Double8 Double8::lane_index() {
+    return {{_mm_set_pd(1, 0), _mm_set_pd(3, 2), _mm_set_pd(5, 4), _mm_set_pd(7, 6)}};
+}
+inline Double8 operator+(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_add_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline Double8 operator*(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_mul_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline Double8 operator/(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_div_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline Double8 operator&(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_and_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline Double8 operator>=(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_cmpge_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline Double8 operator>(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_cmpgt_pd(a.v[i], b.v[i]);
+    return r;
+}
+inline int movemask(const Double8 &m) {
+    return _mm_movemask_pd(m.v[0]) | (_mm_movemask_pd(m.v[1]) << 2) |
+           (_mm_movemask_pd(m.v[2]) << 4) | (_mm_movemask_pd(m.v[3]) << 6);
+}
+inline void store(double *p, const Double8 &a) {
+    for (int i = 0; i < 4; i++) _mm_storeu_pd(p + 2 * i, a.v[i]);
+}
+inline Double8 load(const double *p) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) r.v[i] = _mm_loadu_pd(p + 2 * i);
+    return r;
+}
+inline Double8 load_masked(const double *p, const Double8 &mask) {
+    Double8 r;
+    for (int i = 0; i < 4; i++) {
+        switch (_mm_movemask_pd(mask.v[i])) {
+            case 0: r.v[i] = _mm_setzero_pd(); break;
+            case 1: r.v[i] = _mm_load_sd(p + 2 * i); break;
+            case 2: r.v[i] = _mm_loadh_pd(_mm_setzero_pd(), p + 2 * i + 1); break;
+            default: r.v[i] = _mm_loadu_pd(p + 2 * i); break;
+        }
+    }
+    return r;
+}
+inline void store_masked(double *p, const Double8 &mask, const Double8 &a) {
+    for (int i = 0; i < 4; i++) {
+        switch (_mm_movemask_pd(mask.v[i])) {
+            case 0: break;
+            case 1: _mm_storel_pd(p + 2 * i, a.v[i]); break;
+            case 2: _mm_storeh_pd(p + 2 * i + 1, a.v[i]); break;
+            default: _mm_storeu_pd(p + 2 * i, a.v[i]); break;
+        }
+    }
+}
+
+inline Float8 Float8::set1(float x) {
+    __m128 s = _mm_set1_ps(x);
+    return {{s, s}};
+}
+inline Float8 Float8::lane_index() {
+    return {{_mm_set_ps(3, 2, 1, 0), _mm_set_ps(7, 6, 5, 4)}};
+}
+inline Float8 operator+(const Float8 &a, const Float8 &b) {
+    return {{_mm_add_ps(a.v[0], b.v[0]), _mm_add_ps(a.v[1], b.v[1])}};
+}
+inline Float8 operator*(const Float8 &a, const Float8 &b) {
+    return {{_mm_mul_ps(a.v[0], b.v[0]), _mm_mul_ps(a.v[1], b.v[1])}};
+}
+inline Float8 operator/(const Float8 &a, const Float8 &b) {
+    return {{_mm_div_ps(a.v[0], b.v[0]), _mm_div_ps(a.v[1], b.v[1])}};
+}
+inline Float8 operator&(const Float8 &a, const Float8 &b) {
+    return {{_mm_and_ps(a.v[0], b.v[0]), _mm_and_ps(a.v[1], b.v[1])}};
+}
+inline Float8 operator>=(const Float8 &a, const Float8 &b) {
+    return {{_mm_cmpge_ps(a.v[0], b.v[0]), _mm_cmpge_ps(a.v[1], b.v[1])}};
+}
+inline Float8 operator>(const Float8 &a, const Float8 &b) {
+    return {{_mm_cmpgt_ps(a.v[0], b.v[0]), _mm_cmpgt_ps(a.v[1], b.v[1])}};
+}
+inline int movemask(const Float8 &m) {
+    return _mm_movemask_ps(m.v[0]) | (_mm_movemask_ps(m.v[1]) << 4);
+}
+inline void store(float *p, const Float8 &a) {
+    _mm_storeu_ps(p, a.v[0]);
+    _mm_storeu_ps(p + 4, a.v[1]);
+}
+inline Float8 load(const float *p) {
+    return {{_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}};
+}
+inline Float8 load_masked(const float *p, const Float8 &mask) {
+    int bits = movemask(mask);
+    if (bits == 0xff) {
+        return {{_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}};
+    }
+    float lanes[8];
+    for (int i = 0; i < 8; i++) lanes[i] = (bits >> i) & 1 ? p[i] : 0.f;
+    return {{_mm_loadu_ps(lanes), _mm_loadu_ps(lanes + 4)}};
+}
+inline void store_masked(float *p, const Float8 &mask, const Float8 &a) {
+    int bits = movemask(mask);
+    if (bits == 0xff) {
+        store(p, a);
+        return;
+    }
+    float lanes[8];
+    store(lanes, a);
+    for (int i = 0; i < 8; i++) {
+        if ((bits >> i) & 1) p[i] = lanes[i];
+    }
+}
+inline void convert(const Double8 &a, Float8 &out) {
+    out.v[0] = _mm_movelh_ps(_mm_cvtpd_ps(a.v[0]), _mm_cvtpd_ps(a.v[1]));
+    out.v[1] = _mm_movelh_ps(_mm_cvtpd_ps(a.v[2]), _mm_cvtpd_ps(a.v[3]));
+}
+inline Float8 operator-(const Float8 &a, const Float8 &b) {
+    return {{_mm_sub_ps(a.v[0], b.v[0]), _mm_sub_ps(a.v[1], b.v[1])}};
+}
+inline Float8 min(const Float8 &a, const Float8 &b) {
+    return {{_mm_min_ps(a.v[0], b.v[0]), _mm_min_ps(a.v[1], b.v[1])}};
+}
+inline Float8 max(const Float8 &a, const Float8 &b) {
+    return {{_mm_max_ps(a.v[0], b.v[0]), _mm_max_ps(a.v[1], b.v[1])}};
+}
+inline Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b) {
+    return {{_mm_or_ps(_mm_and_ps(mask.v[0], a.v[0]), _mm_andnot_ps(mask.v[0], b.v[0])),
+             _mm_or_ps(_mm_and_ps(mask.v[1], a.v[1]), _mm_andnot_ps(mask.v[1], b.v[1]))}};
+}
+inline Float8 rsqrt_estimate(const Float8 &a) {
+    return {{_mm_rsqrt_ps(a.v[0]), _mm_rsqrt_ps(a.v[1])}};
+}
+inline Float8 floor(const Float8 &a) {
+    // SSE2 only truncates, which rounds the negative values up
+    Float8 r;
+    for (int h = 0; h < 2; h++) {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v[h]));
+        r.v[h] = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v[h]), _mm_set1_ps(1.f)));
+    }
+    return r;
+}
+inline Float8 split_exponent(const Float8 &a, Float8 &mantissa) {
+    Float8 exponent;
+    for (int h = 0; h < 2; h++) {
+        __m128i bits = _mm_castps_si128(a.v[h]);
+        mantissa.v[h] = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                                      _mm_set1_epi32(0x3f800000)));
+        exponent.v[h] = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    }
+    return exponent;
+}
+inline Float8 exp2_integer(const Float8 &n) {
+    Float8 r;
+    for (int h = 0; h < 2; h++) {
+        __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.v[h]), _mm_set1_epi32(127));
+        r.v[h] = _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+    }
+    return r;
+}
+
+#else
+
+inline Double8 Double8::set1(double x) {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = x;
+    return r;
+}
+inline Double8 Double8::lane_index() {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = i;
+    return r;
+}
+inline Float8 Float8::set1(float x) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = x;
+    return r;
+}
+inline Float8 Float8::lane_index() {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = float(i);
+    return r;
+}
+
+// Lane masks are all-ones bit patterns, so the bitwise ops
+// go through integers of the lane size.
+template <typename T> struct LaneBits;
+template <> struct LaneBits<double> { using type = uint64_t; };
+template <> struct LaneBits<float> { using type = uint32_t; };
+
+template <typename Pack, typename T = decltype(+Pack().v[0])>
+inline Pack lanewise_and(const Pack &a, const Pack &b) {
+    using Bits = typename LaneBits<T>::type;
+    Pack r;
+    for (int i = 0; i < 8; i++) {
+        Bits x, y;
+        std::memcpy(&x, &a.v[i], sizeof(T));
+        std::memcpy(&y, &b.v[i], sizeof(T));
+        x &= y;
+        std::memcpy(&r.v[i], &x, sizeof(T));
+    }
+    return r;
+}
+template <typename Pack, typename T = decltype(+Pack().v[0])>
+inline Pack lanewise_compare(const Pack &a, const Pack &b, bool ge) {
+    using Bits = typename LaneBits<T>::type;
+    Pack r;
+    for (int i = 0; i < 8; i++) {
+        Bits bits = (ge ? a.v[i] >= b.v[i] : a.v[i] > b.v[i]) ? ~Bits(0) : 0;
+        std::memcpy(&r.v[i], &bits, sizeof(T));
+    }
+    return r;
+}
+template <typename Pack, typename T = decltype(+Pack().v[0])>
+inline int lanewise_movemask(const Pack &m) {
+    using Bits = typename LaneBits<T>::type;
+    int bits = 0;
+    for (int i = 0; i < 8; i++) {
+        Bits x;
+        std::memcpy(&x, &m.v[i], sizeof(T));
+        bits |= int(x >> (8 * sizeof(T) - 1)) << i;
+    }
+    return bits;
+}
+
+inline Double8 operator+(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] + b.v[i];
+    return r;
+}
+inline Double8 operator*(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] * b.v[i];
+    return r;
+}
+inline Double8 operator/(const Double8 &a, const Double8 &b) {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] / b.v[i];
+    return r;
+}
+inline Double8 operator&(const Double8 &a, const Double8 &b) {
+    return lanewise_and(a, b);
+}
+inline Double8 operator>=(const Double8 &a, const Double8 &b) {
+    return lanewise_compare(a, b, true);
+}
+inline Double8 operator>(const Double8 &a, const Double8 &b) {
+    return lanewise_compare(a, b, false);
+}
+inline int movemask(const Double8 &m) {
+    return lanewise_movemask(m);
+}
+inline void store(double *p, const Double8 &a) {
+    for (int i = 0; i < 8; i++) p[i] = a.v[i];
+}
+inline Double8 load(const double *p) {
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = p[i];
+    return r;
+}
+inline Double8 load_masked(const double *p, const Double8 &mask) {
+    int bits = movemask(mask);
+    Double8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = (bits >> i) & 1 ? p[i] : 0.0;
+    return r;
+}
+inline void store_masked(double *p, const Double8 &mask, const Double8 &a) {
+    int bits = movemask(mask);
+    for (int i = 0; i < 8; i++) {
+        if ((bits >> i) & 1) p[i] = a.v[i];
+    }
+}
+
+inline Float8 operator+(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] + b.v[i];
+    return r;
+}
+inline Float8 operator*(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] * b.v[i];
+    return r;
+}
+inline Float8 operator/(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] / b.v[i];
+    return r;
+}
+inline Float8 operator&(const Float8 &a, const Float8 &b) {
+    return lanewise_and(a, b);
+}
+inline Float8 operator>=(const Float8 &a, const Float8 &b) {
+    return lanewise_compare(a, b, true);
+}
+inline Float8 operator>(const Float8 &a, const Float8 &b) {
+    return lanewise_compare(a, b, false);
+}
+inline int movemask(const Float8 &m) {
+    return lanewise_movemask(m);
+}
+inline void store(float *p, const Float8 &a) {
+    for (int i = 0; i < 8; i++) p[i] = a.v[i];
+}
+inline Float8 load(const float *p) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = p[i];
+    return r;
+}
+inline Float8 load_masked(const float *p, const Float8 &mask) {
+    int bits = movemask(mask);
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = (bits >> i) & 1 ? p[i] : 0.f;
+    return r;
+}
+inline void store_masked(float *p, const Float8 &mask, const Float8 &a) {
+    int bits = movemask(mask);
+    for (int i = 0; i < 8; i++) {
+        if ((bits >> i) & 1) p[i] = a.v[i];
+    }
+}
+inline void convert(const Double8 &a, Float8 &out) {
+    for (int i = 0; i < 8; i++) out.v[i] = float(a.v[i]);
+}
+inline Float8 operator-(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = a.v[i] - b.v[i];
+    return r;
+}
+inline Float8 min(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i];
+    return r;
+}
+inline Float8 max(const Float8 &a, const Float8 &b) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i];
+    return r;
+}
+inline Float8 select(const Float8 &mask, const Float8 &a, const Float8 &b) {
+    int bits = movemask(mask);
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = (bits >> i) & 1 ? a.v[i] : b.v[i];
+    return r;
+}
+inline Float8 rsqrt_estimate(const Float8 &a) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = 1.f / std::sqrt(a.v[i]);
+    return r;
+}
+inline Float8 floor(const Float8 &a) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) r.v[i] = std::floor(a.v[i]);
+    return r;
+}
+inline Float8 split_exponent(const Float8 &a, Float8 &mantissa) {
+    Float8 exponent;
+    for (int i = 0; i < 8; i++) {
+        uint32_t bits;
+        std::memcpy(&bits, &a.v[i], sizeof(float));
+        exponent.v[i] = float(int(bits >> 23) - 127);
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        std::memcpy(&mantissa.v[i], &bits, sizeof(float));
+    }
+    return exponent;
+}
+inline Float8 exp2_integer(const Float8 &n) {
+    Float8 r;
+    for (int i = 0; i < 8; i++) {
+        uint32_t bits = uint32_t(int(n.v[i]) + 127) << 23;
+        std::memcpy(&r.v[i], &bits, sizeof(float));
+    }
+    return r;
+}
+
+#endif
+
+/// No-op conversion, so kernels can convert to their pack type unconditionally.
+inline void convert(const Double8 &a, Double8 &out) {
+    out = a;
+}
+inline void convert(const Float8 &a, Float8 &out) {
+    out = a;
+}
+
+// Fast approximations for shading, in terms of the operations above.
+
+/// 1 / sqrt(a) for positive a, the estimate refined by a Newton step to about 22 bits.
+inline Float8 fast_rsqrt(const Float8 &a) {
+    Float8 y = rsqrt_estimate(a);
+    return y * (Float8::set1(1.5f) - Float8::set1(0.5f) * a * y * y);
+}
+
+/// log2(a) for a >= 0, within 2e-5; zero comes out as -127.
+inline Float8 fast_log2(const Float8 &a) {
+    Float8 mantissa;
+    Float8 exponent = split_exponent(a, mantissa);
+    // log2(1 + t) ~ t * p(t) over t in [0, 1), fitted for the least maximum error
+    Float8 t = mantissa - Float8::set1(1.f);
+    Float8 p = Float8::set1(0.0463832758f);
+    p = p * t + Float8::set1(-0.196264569f);
+    p = p * t + Float8::set1(0.417591534f);
+    p = p * t + Float8::set1(-0.709661413f);
+    p = p * t + Float8::set1(1.44196547f);
+    return exponent + p * t;
+}
+
+/// 2^a within a relative 3e-6, flushed to 2^-126 below it.
+inline Float8 fast_exp2(const Float8 &a) {
+    Float8 x = min(max(a, Float8::set1(-126.f)), Float8::set1(127.f));
+    Float8 n = floor(x);
+    // 2^f over f in [0, 1), fitted for the least maximum relative error
+    Float8 f = x - n;
+    Float8 p = Float8::set1(0.0135341454f);
+    p = p * f + Float8::set1(0.0520115039f);
+    p = p * f + Float8::set1(0.241442731f);
+    p = p * f + Float8::set1(0.693003839f);
+    p = p * f + Float8::set1(1.00000259f);
+    return p * exp2_integer(n);
+}
+
+/// a^b for a >= 0, as 2^(b log2 a).
+inline Float8 fast_pow(const Float8 &a, const Float8 &b) {
+    return fast_exp2(b * fast_log2(a));
+}
+
+} // namespace SIMD_NAMESPACE